@@ -0,0 +1,127 @@
+/*
+ * 20261019.001
+ * SD Card
+ *
+ * File: Export.c
+ * Processor: PIC12F1840
+ * Author: wizlab.it
+ */
+
+#include "Export.h"
+
+void SD_Export_Init(void) {
+    //Move card CS to RA5, RA4 becomes EUSART TX.
+    //Call after SD_SPI_Init (it sets CARD0 CS back to RA4) and before SD_Card_Init
+    SD_Card_Setup(&SD_CARD0, _SD_SPI_CS_RA5);
+    APFCONbits.TXCKSEL = 1;     //TX on RA4 (pin 3)
+    TRISAbits.TRISA4 = 0;       //Output, EUSART TX
+    TRISAbits.TRISA3 = 1;       //Input, request
+    IOCANbits.IOCAN3 = 1;       //Falling edges set IOCAF3 (no interrupt): abort while sending
+
+    //Configure EUSART: asynchronous, 8 bit, transmit only, 16 bit baud rate generator
+    BAUDCONbits.BRG16 = 1;
+    TXSTAbits.BRGH = 1;
+    TXSTAbits.SYNC = 0;
+    SPBRGH = 0;
+    SPBRGL = _SD_EXPORT_BRG;
+    RCSTAbits.SPEN = 1;
+    TXSTAbits.TXEN = 1;
+}
+
+void SD_Export_Run(void) {
+    //Serve requests forever
+    uint8_t req[_SD_EXPORT_REQUEST_SIZE];
+    while(1) {
+        //Receive the whole request first: nothing slow may run between two request bits.
+        //If bits stop coming, drop the partial request and wait for a new one
+        uint8_t i;
+        for(i=0; i<_SD_EXPORT_REQUEST_SIZE; i++) {
+            if(!SD_Export_GetByte(&req[i], (i == 0))) break;
+        }
+        if((i != _SD_EXPORT_REQUEST_SIZE) || (req[0] != _SD_EXPORT_REQUEST)) continue;
+
+        uint32_t sector = ((uint32_t)req[1] << 24) | ((uint32_t)req[2] << 16) | ((uint16_t)req[3] << 8) | req[4];
+        uint16_t count = (uint16_t)(req[5] << 8) | req[6];
+        SD_Export_Send(sector, count);
+    }
+}
+
+void SD_Export_Send(uint32_t sector, uint16_t count) {
+    //Speed up SPI, so reading a byte takes less than transmitting it
+    SSP1CON1bits.SSPEN = 0;
+    SSP1CON1bits.SSPM = _SD_EXPORT_SPI_SSPM;
+    SSP1CON1bits.SSPEN = 1;
+
+    //Edges of the request itself are not an abort
+    IOCAFbits.IOCAF3 = 0;
+
+    //The whole range must be addressable, or the byte address would wrap
+    if((count != 0) && (sector <= _SD_MAX_SECTOR) && ((uint32_t)(count - 1) <= (_SD_MAX_SECTOR - sector))
+            && SD_Card_ReadInitCount(sector * _SD_BLOCK_SIZE, count)) {
+        for(; count!=0; count--) {
+            //On abort from the host stop here, the end mark follows
+            if(IOCAFbits.IOCAF3 == 1) break;
+
+            //On data error token stop here: the host sees the early end mark and requests the rest again
+            if(!SD_Card_RWStartMulti()) break;
+            SD_Export_Put(_SD_EXPORT_SYNC);
+            SD_Export_Put32(sector++);
+
+            //Pipeline: start reading the next byte from the card, then transmit the current one
+            SSP1BUF = 0xFF;
+            for(uint16_t i=_SD_BLOCK_SIZE; i!=0; i--) {
+                while(!SSP1STATbits.BF);
+                uint8_t c = SSP1BUF;
+                if(i != 1) SSP1BUF = 0xFF;
+                SD_Export_Put(c);
+            }
+
+            uint16_t crc = SD_Card_RWStopMulti();
+            SD_Export_Put((uint8_t)(crc >> 8));
+            SD_Export_Put((uint8_t)crc);
+        }
+        SD_Card_RWEnd();
+    }
+
+    //Mark end of range
+    SD_Export_Put(_SD_EXPORT_SYNC);
+    SD_Export_Put32(_SD_EXPORT_END_SECTOR);
+
+    //Restore SPI clock
+    SSP1CON1bits.SSPEN = 0;
+    SSP1CON1bits.SSPM = 0b0010;
+    SSP1CON1bits.SSPEN = 1;
+}
+
+void SD_Export_Put(uint8_t c) {
+    while(!PIR1bits.TXIF);      //Wait until transmit buffer is free
+    TXREG = c;
+}
+
+void SD_Export_Put32(uint32_t v) {
+    SD_Export_Put((uint8_t)(v >> 24));
+    SD_Export_Put((uint8_t)(v >> 16));
+    SD_Export_Put((uint8_t)(v >> 8));
+    SD_Export_Put((uint8_t)v);
+}
+
+uint8_t SD_Export_GetByte(uint8_t *dst, uint8_t isFirst) {
+    //Every bit is a whole UART byte from the host: a long low pulse (0x00) is 0, a short one (0xFF) is 1.
+    //The first bit of a request may take forever, any other one must come within _SD_EXPORT_RX_TIMEOUT
+    uint8_t byte = 0;
+    for(uint8_t i=0; i<8; i++) {
+        uint8_t overflows = 0;
+        TMR0IF = 0;
+        while(_SD_EXPORT_RX) {                  //Wait for start bit
+            if(TMR0IF) {
+                TMR0IF = 0;
+                if(((i != 0) || (isFirst == 0)) && (++overflows == _SD_EXPORT_RX_TIMEOUT)) return 0;
+            }
+        }
+        __delay_us(_SD_EXPORT_RX_SAMPLE_US);
+        byte = (uint8_t)((byte << 1) | _SD_EXPORT_RX);
+        while(!_SD_EXPORT_RX);                  //Wait for end of pulse
+    }
+    *dst = byte;
+    return 1;
+}
\ No newline at end of file
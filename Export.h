@@ -0,0 +1,65 @@
+/*
+ * 20261019.001
+ * SD Card
+ *
+ * File: Export.h
+ * Processor: PIC12F1840
+ * Author: wizlab.it
+ *
+ * Export a sector range over the EUSART, reading the card while the previous
+ * byte is transmitted. The EUSART needs its own pins, so export wiring is:
+ *  - RA0: SPI SDO, RA1: SPI SCK, RA2: SPI SDI (unchanged)
+ *  - RA5: card CS (led cannot be used: build with _SD_RA5_CS, see commons.h)
+ *  - RA4: EUSART TX
+ *  - RA3: request input (RA3 has no EUSART function, so it is decoded in software)
+ *
+ * Request (host to PIC): _SD_EXPORT_REQUEST, first sector (4 bytes), sector count (2 bytes), big endian.
+ * The host sends every request bit as a whole UART byte at the export baud rate: 0x00 for 0, 0xFF for 1.
+ * The PIC only has to tell a long low pulse (9us) from a short one (1us, start bit only), sampling
+ * _SD_EXPORT_RX_SAMPLE_US after the falling edge.
+ * After the end of a 0 pulse the PIC needs roughly 40 instruction cycles (5us at 8 MIPS, estimated from
+ * the -O0 code between two samples: end of pulse wait, shift, loop or return and store, next call) before
+ * it is waiting for the next edge again. Back to back bytes with 1 or 2 stop bits leave only 1-2us, so the
+ * host sends every byte on its own with _SD_EXPORT_RX_GAP_US of idle line after it (tools/export.c).
+ * This margin has been estimated, not measured on hardware.
+ *
+ * Answer (PIC to host), for each sector:
+ *  - _SD_EXPORT_SYNC
+ *  - sector number (4 bytes, big endian)
+ *  - 512 data bytes
+ *  - CRC16 CCITT of data (2 bytes, big endian), as sent by the card
+ * then _SD_EXPORT_SYNC followed by _SD_EXPORT_END_SECTOR. If the range ends early (e.g. read error),
+ * the host resumes by sending a new request from the first missing sector. A range past
+ * _SD_MAX_SECTOR is not read at all, only the end mark is sent.
+ *
+ * Abort: any byte from the host while a range is sent. Its falling edge on RA3 is latched by
+ * interrupt-on-change, and checked before every sector, so at most one more sector follows before
+ * the end mark. Request bits come back to back, so a request with no bit for _SD_EXPORT_RX_TIMEOUT
+ * Timer0 overflows is dropped: the host leaves the line idle longer than that after an abort, in case
+ * the abort byte arrived after the end of the range and was taken as the start of a request.
+ */
+
+#ifndef EXPORT_H
+#define	EXPORT_H
+
+#include "commons.h"
+
+#define _SD_EXPORT_RX               PORTAbits.RA3   //Request input
+#define _SD_EXPORT_RX_SAMPLE_US     4               //Sample point after the falling edge
+#define _SD_EXPORT_RX_GAP_US        100             //Minimum idle time the host leaves after every request byte
+#define _SD_EXPORT_RX_TIMEOUT       2               //Timer0 overflows (8ms each) without a request bit, so 8 to 16ms
+#define _SD_EXPORT_REQUEST_SIZE     7
+#define _SD_EXPORT_BRG              7               //Baud rate = FOSC / (4 * (BRG + 1)) = 1Mbaud
+#define _SD_EXPORT_SPI_SSPM         0b0001          //SPI clock = FOSC / 16, faster than the EUSART
+#define _SD_EXPORT_REQUEST          0x52
+#define _SD_EXPORT_SYNC             0x7E
+#define _SD_EXPORT_END_SECTOR       0xFFFFFFFF
+
+void SD_Export_Init(void);
+void SD_Export_Run(void);
+void SD_Export_Send(uint32_t sector, uint16_t count);
+void SD_Export_Put(uint8_t c);
+void SD_Export_Put32(uint32_t v);
+uint8_t SD_Export_GetByte(uint8_t *dst, uint8_t isFirst);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,95 @@
+/*
+ * 20261019.001
+ * SD Card
+ *
+ * File: Index.c
+ * Processor: PIC12F1840
+ * Author: wizlab.it
+ */
+
+#include "Index.h"
+
+uint8_t SD_Index_Validate(void) {
+    uint32_t serial;
+
+    //Without an initialized card the serial is unknown: leave the index as it is
+    if(!SD_Card_IsActive()) return 0;
+
+    //Index is valid if it has been built for the current card
+    if(eeprom_read(0) == _SD_INDEX_MAGIC) {
+        SD_Index_Read(1, (uint8_t *)&serial, 4);
+        if(serial == SD_CID.serial) return 1;
+    }
+
+    //If here, index is missing or refers to another card: clear it, entries will be stored again when found
+    for(uint8_t i=0; i<_SD_INDEX_ENTRIES; i++) {
+        if(eeprom_read(_SD_INDEX_HEADER_SIZE + (i * _SD_INDEX_ENTRY_SIZE)) != _SD_INDEX_FREE) {
+            eeprom_write(_SD_INDEX_HEADER_SIZE + (i * _SD_INDEX_ENTRY_SIZE), _SD_INDEX_FREE);
+        }
+    }
+    serial = SD_CID.serial;
+    SD_Index_Write(1, (uint8_t *)&serial, 4);
+    eeprom_write(0, _SD_INDEX_MAGIC);
+    return 0;
+}
+
+uint8_t SD_Index_Find(const char *name, SD_INDEX_ENTRY *entry) {
+    if(SD_Index_Validate()) {
+        uint8_t slot = SD_Index_Lookup(name);
+        if(slot != _SD_INDEX_FREE) {
+            SD_Index_Read(_SD_INDEX_HEADER_SIZE + (slot * _SD_INDEX_ENTRY_SIZE) + _SD_INDEX_NAME_SIZE, (uint8_t *)entry, sizeof(SD_INDEX_ENTRY));
+            return _SD_OK_FLAG;
+        }
+    }
+
+    //If here, file is not indexed: caller has to scan the card and store it
+    return _SD_ERR_FLAG;
+}
+
+void SD_Index_Store(const char *name, SD_INDEX_ENTRY *entry) {
+    if(!SD_Card_IsActive()) return;
+    SD_Index_Validate();
+
+    //Update the entry of the file, or use a free one. If index is full, replace the last entry
+    uint8_t slot = SD_Index_Lookup(name);
+    if(slot == _SD_INDEX_FREE) {
+        for(slot=0; slot<(_SD_INDEX_ENTRIES - 1); slot++) {
+            if(eeprom_read(_SD_INDEX_HEADER_SIZE + (slot * _SD_INDEX_ENTRY_SIZE)) == _SD_INDEX_FREE) break;
+        }
+    }
+
+    //Free the entry while writing it: name byte 0 is the free marker, so it is written last.
+    //An interrupted write never leaves a valid name with partial data
+    uint8_t addr = _SD_INDEX_HEADER_SIZE + (slot * _SD_INDEX_ENTRY_SIZE);
+    if(eeprom_read(addr) != _SD_INDEX_FREE) eeprom_write(addr, _SD_INDEX_FREE);
+    SD_Index_Write(addr + _SD_INDEX_NAME_SIZE, (const uint8_t *)entry, sizeof(SD_INDEX_ENTRY));
+    SD_Index_Write(addr + 1, (const uint8_t *)name + 1, _SD_INDEX_NAME_SIZE - 1);
+    SD_Index_Write(addr, (const uint8_t *)name, 1);
+}
+
+uint8_t SD_Index_Lookup(const char *name) {
+    for(uint8_t slot=0; slot<_SD_INDEX_ENTRIES; slot++) {
+        uint8_t addr = _SD_INDEX_HEADER_SIZE + (slot * _SD_INDEX_ENTRY_SIZE);
+        uint8_t i;
+        for(i=0; i<_SD_INDEX_NAME_SIZE; i++) {
+            if(eeprom_read(addr + i) != (uint8_t)name[i]) break;
+        }
+        if(i == _SD_INDEX_NAME_SIZE) return slot;
+    }
+    return _SD_INDEX_FREE;
+}
+
+void SD_Index_Read(uint8_t addr, uint8_t *dst, uint8_t len) {
+    for(uint8_t i=0; i<len; i++) {
+        *dst++ = eeprom_read(addr++);
+    }
+}
+
+void SD_Index_Write(uint8_t addr, const uint8_t *src, uint8_t len) {
+    //Write only changed bytes: EEPROM writes are slow and wear the cells
+    for(uint8_t i=0; i<len; i++) {
+        if(eeprom_read(addr) != *src) eeprom_write(addr, *src);
+        addr++;
+        src++;
+    }
+}
\ No newline at end of file
@@ -0,0 +1,46 @@
+/*
+ * 20261019.001
+ * SD Card
+ *
+ * File: Index.h
+ * Processor: PIC12F1840
+ * Author: wizlab.it
+ *
+ * Persistent file index in data EEPROM, so a file can be opened without
+ * scanning directory and FAT on the card.
+ *  - 0x00: _SD_INDEX_MAGIC
+ *  - 0x01-0x04: serial of the card (SD_CID.serial) the index refers to
+ *  - 0x05-...: _SD_INDEX_ENTRIES entries, _SD_INDEX_ENTRY_SIZE bytes each
+ *     - byte 0-10: FAT 8.3 name, space padded ("LOG     TXT"), 0xFF if entry is free
+ *     - byte 11-21: SD_INDEX_ENTRY
+ * The index is reset when a different card is found, and filled again as
+ * files are located on the new card.
+ */
+
+#ifndef INDEX_H
+#define	INDEX_H
+
+#include "commons.h"
+
+#define _SD_INDEX_MAGIC         0x49
+#define _SD_INDEX_HEADER_SIZE   5
+#define _SD_INDEX_NAME_SIZE     11
+#define _SD_INDEX_ENTRY_SIZE    (_SD_INDEX_NAME_SIZE + sizeof(SD_INDEX_ENTRY))
+#define _SD_INDEX_ENTRIES       8
+#define _SD_INDEX_FREE          0xFF
+
+typedef struct {
+    uint32_t dirSector;     //Sector holding the directory entry
+    uint32_t firstCluster;  //First cluster of the file
+    uint16_t clusterRun;    //Contiguous clusters starting from firstCluster
+    uint8_t dirIndex;       //Entry index in the directory sector
+} SD_INDEX_ENTRY;
+
+uint8_t SD_Index_Validate(void);
+uint8_t SD_Index_Find(const char *name, SD_INDEX_ENTRY *entry);
+void SD_Index_Store(const char *name, SD_INDEX_ENTRY *entry);
+uint8_t SD_Index_Lookup(const char *name);
+void SD_Index_Read(uint8_t addr, uint8_t *dst, uint8_t len);
+void SD_Index_Write(uint8_t addr, const uint8_t *src, uint8_t len);
+
+#endif
\ No newline at end of file
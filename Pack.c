@@ -0,0 +1,102 @@
+/*
+ * 20261019.001
+ * SD Card
+ *
+ * File: Pack.c
+ * Processor: PIC12F1840
+ * Author: wizlab.it
+ */
+
+#include "Pack.h"
+
+uint8_t SD_Pack_Begin(uint32_t addr) {
+    SD_PACK.rawOffset = 0;
+    SD_PACK.used = 0;
+    SD_PACK.count = 0;
+
+    //Start on an AU boundary: a write starting inside an AU may make the card copy the sectors before it.
+    //Near the end of the card there may be no boundary left
+    uint32_t start = SD_Card_AUAlign(addr);
+    if(start < addr) return 0;
+    return SD_Card_RWInit(start, _SD_WRITE_FLAG, _SD_BLOCK_MULTI_FLAG);
+}
+
+uint8_t SD_Pack_Put(uint8_t c) {
+    //Extend the pending run, or flush it and start a new one. On error the caller has to end the session
+    if((SD_PACK.count != 0) && (c == SD_PACK.value) && (SD_PACK.count != _SD_PACK_RUN_MAX)) {
+        SD_PACK.count++;
+        return _SD_OK_FLAG;
+    }
+    if(SD_Pack_Flush() != _SD_OK_FLAG) return _SD_ERR_FLAG;
+    SD_PACK.value = c;
+    SD_PACK.count = 1;
+    return _SD_OK_FLAG;
+}
+
+uint8_t SD_Pack_End(void) {
+    uint8_t result = SD_Pack_Flush();
+    if(SD_PACK.used != 0) SD_Pack_CloseSector();
+    SD_Card_RWEnd();
+    return result;
+}
+
+uint8_t SD_Pack_Flush(void) {
+    if(SD_PACK.count == 0) return _SD_OK_FLAG;
+
+    //Short runs of plain bytes are cheaper as literals, the escape byte always needs a token
+    if((SD_PACK.count < _SD_PACK_RUN_MIN) && (SD_PACK.value != _SD_PACK_ESC)) {
+        for(uint8_t i=0; i<SD_PACK.count; i++) {
+            if(!SD_Pack_Reserve(1)) return _SD_ERR_FLAG;
+            SD_SPI_Write(SD_PACK.value);
+            SD_PACK.rawOffset++;
+        }
+    } else {
+        if(!SD_Pack_Reserve(3)) return _SD_ERR_FLAG;
+        SD_SPI_Write(_SD_PACK_ESC);
+        SD_SPI_Write(SD_PACK.count);
+        SD_SPI_Write(SD_PACK.value);
+        SD_PACK.rawOffset += SD_PACK.count;
+    }
+    SD_PACK.count = 0;
+    return _SD_OK_FLAG;
+}
+
+uint8_t SD_Pack_Reserve(uint8_t len) {
+    //If the token does not fit, close current sector
+    if((SD_PACK.used != 0) && ((SD_PACK.used + len) > _SD_BLOCK_SIZE)) {
+        SD_Pack_CloseSector();
+    }
+
+    //If no sector is open, start a new one with its header
+    if(SD_PACK.used == 0) {
+        uint8_t *p = (uint8_t *)&SD_PACK.rawOffset;
+        if(!SD_Card_RWStartMulti()) return 0;
+        SD_SPI_Write(_SD_PACK_MAGIC);
+        SD_SPI_Write(*(p + 3));
+        SD_SPI_Write(*(p + 2));
+        SD_SPI_Write(*(p + 1));
+        SD_SPI_Write(*p);
+        SD_PACK.used = _SD_PACK_HEADER_SIZE;
+    }
+
+    SD_PACK.used += len;
+    return 1;
+}
+
+void SD_Pack_CloseSector(void) {
+    //Mark end of data and pad the rest of the sector
+    if(SD_PACK.used < _SD_BLOCK_SIZE) {
+        SD_SPI_Write(_SD_PACK_ESC);
+        SD_PACK.used++;
+    }
+    if(SD_PACK.used < _SD_BLOCK_SIZE) {
+        SD_SPI_Write(0x00);
+        SD_PACK.used++;
+    }
+    for(; SD_PACK.used<_SD_BLOCK_SIZE; SD_PACK.used++) {
+        SD_SPI_Write(0xFF);
+    }
+
+    SD_Card_RWStopMulti();
+    SD_PACK.used = 0;
+}
\ No newline at end of file
@@ -0,0 +1,45 @@
+/*
+ * 20261019.001
+ * SD Card
+ *
+ * File: Pack.h
+ * Processor: PIC12F1840
+ * Author: wizlab.it
+ *
+ * Streaming RLE compression on top of a multi block write session. The session starts at the
+ * first AU boundary at or after the given address, then SD_CURRENT->addr tells where.
+ * Every sector decodes on its own:
+ *  - byte 0: _SD_PACK_MAGIC
+ *  - byte 1-4: raw offset (big endian) of the first byte decoded from this sector
+ *  - then tokens until the end of the sector:
+ *     - any byte but _SD_PACK_ESC: literal byte
+ *     - _SD_PACK_ESC, n, v: byte v repeated n times (n = 1..255)
+ *     - _SD_PACK_ESC, 0 (or _SD_PACK_ESC as last byte): end of data, the rest of the sector is padding
+ */
+
+#ifndef PACK_H
+#define	PACK_H
+
+#include "commons.h"
+
+#define _SD_PACK_MAGIC          0x50
+#define _SD_PACK_ESC            0xA5
+#define _SD_PACK_HEADER_SIZE    5
+#define _SD_PACK_RUN_MIN        3       //Shorter runs are written as literals
+#define _SD_PACK_RUN_MAX        255
+
+struct {
+    uint32_t rawOffset;     //Raw bytes written in closed tokens
+    uint16_t used;          //Bytes used in the current sector, 0 if no sector is open
+    uint8_t value;          //Pending run byte
+    uint8_t count;          //Pending run length
+} SD_PACK;
+
+uint8_t SD_Pack_Begin(uint32_t addr);
+uint8_t SD_Pack_Put(uint8_t c);
+uint8_t SD_Pack_End(void);
+uint8_t SD_Pack_Flush(void);
+uint8_t SD_Pack_Reserve(uint8_t len);
+void SD_Pack_CloseSector(void);
+
+#endif
\ No newline at end of file
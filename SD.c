@@ -1,5 +1,5 @@
 /*
- * 20190412.070
+ * 20261019.074
  * SD Card
  *
  * File: SPI.c
@@ -9,17 +9,22 @@
 
 #include "SD.h"
 
+//Allocation unit sizes, in 16KB units, indexed by the SD Status AU_SIZE code
+const uint16_t SD_AU_SIZE[16] = { 0, 1, 2, 4, 8, 16, 32, 64, 128, 256, 512, 768, 1024, 1536, 2048, 4096 };
+
 void SD_SPI_Init(void) {
     //Set Alternate PIN Functions
     APFCONbits.SDOSEL = 0;  //SDO on RA0 (pin 7)
     APFCONbits.SSSEL = 0;   //SS on RA3 (pin 4)
 
     //Configure pins to work as SPI
-    TRISAbits.TRISA4 = 0;   //Output, SPI CS
     TRISAbits.TRISA2 = 1;   //Input, SPI SDI
     TRISAbits.TRISA0 = 0;   //Output, SPI SCK Master Mode
     TRISAbits.TRISA0 = 0;   //Output, SPI SDO
-    _SD_SPI_CS = 1;         //Disable slaves
+
+    //Setup default card (CS on RA4) and disable it
+    SD_Card_Setup(&SD_CARD0, _SD_SPI_CS_RA4);
+    SD_Card_Select(&SD_CARD0);
 
     //Configure Serial Port
     SSP1STATbits.CKE = 1;           //Transmit from active to idle
@@ -47,17 +52,30 @@ uint8_t SD_SPI_Read(void) {
     return response;
 }
 
+void SD_Card_Setup(SD_CARD *card, uint8_t csMask) {
+    //Drive CS high before making the pin an output, so the card never sees a low glitch
+    card->csMask = csMask;
+    LATA |= csMask;
+    TRISA &= (uint8_t)~csMask;
+}
+
+void SD_Card_Select(SD_CARD *card) {
+    SD_CURRENT = card;
+}
+
 void SD_Card_Enable(void) {
     SD_SPI_Clock(8);    //Send clocks to card sync
-    _SD_SPI_CS = 0;     //Enable card
+    _SD_SPI_CS_LOW();   //Enable card
 
     //Check if busy from a previous action
     SD_SPI_Clock(1);
     SD_Card_WaitIfBusy();
+    SD_FLAGS.isCardBusy = 0;
+    SD_FLAGS.isCardReleased = 0;
 }
 
 void SD_Card_Disable(void) {
-    _SD_SPI_CS = 1;     //Disable card
+    _SD_SPI_CS_HIGH();  //Disable card
     SD_SPI_Clock(1);    //Send clocks to flush bus
 }
 
@@ -88,6 +106,12 @@ uint8_t SD_Card_Command(uint8_t cmd, uint32_t a) {
     return response;
 }
 
+uint8_t SD_Card_AppCommand(uint8_t cmd, uint32_t a) {
+    //Application specific commands (ACMD) are prefixed by CMD55
+    SD_Card_Command(_SD_CMD_APP, 0x00000000);
+    return SD_Card_Command(cmd, a);
+}
+
 uint8_t SD_Card_Crc7(uint8_t crc, uint8_t *data, uint8_t len) {
     for(uint16_t i=0; i<len; i++) {
         uint8_t c = *data++;
@@ -124,7 +148,12 @@ void SD_Card_Init(void) {
     //Init flags
     SD_FLAGS.cardResetOK = 0;
     SD_FLAGS.cardInitOK = 0;
+    SD_FLAGS.cardBlockCountOK = 0;
+    SD_FLAGS.isBlockCountSet = 0;
     SD_FLAGS.isCardActive = 0;
+    SD_CURRENT->auBytes = 0;
+    SD_CURRENT->busyTimeout = _SD_BUSY_TIMEOUT;
+    uint8_t isSDC = 1;
 
     //Wait 2ms and then enable card
     __delay_ms(100);
@@ -139,11 +168,15 @@ void SD_Card_Init(void) {
         __delay_ms(10);
     }
 
-    //If reset was fine, then send init command: try at first with SDC command, then MMC. Wait for 0x00 (active status)
+    //If reset was fine, then send init command: try at first with SDC command (ACMD41), then MMC. Wait for 0x00 (active status)
     if(SD_FLAGS.cardResetOK == 1) {
         for(uint8_t i=250; i!=0; i--) {
-            uint8_t response = SD_Card_Command(_SD_CMD_INIT_SDC, 0x00000000);
-            if(response & 0x04) response = SD_Card_Command(_SD_CMD_INIT, 0x00000000);
+            uint8_t response = 0x04;
+            if(isSDC) {
+                response = SD_Card_AppCommand(_SD_CMD_INIT_SDC, 0x00000000);
+                if(response & 0x04) isSDC = 0;
+            }
+            if(!isSDC) response = SD_Card_Command(_SD_CMD_INIT, 0x00000000);
             if(response == 0x00) {
                 SD_FLAGS.cardInitOK = 1;
                 break;
@@ -162,20 +195,24 @@ void SD_Card_Init(void) {
         }
     }
 
-    //If block size has been set, then initialization process was successful so read CID and CSD, and set Active flag
-    if(SD_FLAGS.cardBlockSizeOK == 1) {
-        SD_Card_ReadReg16(_SD_CMD_READ_CID, (uint8_t *)&SD_CID);
-        SD_Card_ReadReg16(_SD_CMD_READ_CSD, (uint8_t *)&SD_CSD);
+    //If block size has been set and CID and CSD can be read, then initialization process was successful so set Active flag
+    if((SD_FLAGS.cardBlockSizeOK == 1) && SD_Card_ReadReg16(_SD_CMD_READ_CID, (uint8_t *)&SD_CID) && SD_Card_ReadReg16(_SD_CMD_READ_CSD, (uint8_t *)&SD_CSD)) {
+        //SD cards only: read SCR to know if predefined-count multi block reads (CMD23) are supported
+        SD_SCR.cmd_support = 0;
+        if(isSDC) SD_Card_ReadSCR();
+        if(SD_SCR.cmd_support & _SD_SCR_CMD23_SUPPORT) SD_FLAGS.cardBlockCountOK = 1;
+
+        //SD cards only: read SD Status to know allocation unit size and erase timing
+        if(isSDC) SD_Card_ReadSSR();
+
         SD_FLAGS.isCardActive = 1;
     }
 
     SD_Card_Disable();
 }
 
-void SD_Card_ReadReg16(uint8_t reg, uint8_t *dst) {
-    if(SD_Card_Command(reg, 0x00000000) == 0x00) {
-        SD_Card_WaitStartToken();
-
+uint8_t SD_Card_ReadReg16(uint8_t reg, uint8_t *dst) {
+    if((SD_Card_Command(reg, 0x00000000) == 0x00) && SD_Card_WaitStartToken()) {
         //Read data (16 bytes)
         dst += 16;
         for(uint8_t i=0; i<16; i++) {
@@ -184,6 +221,62 @@ void SD_Card_ReadReg16(uint8_t reg, uint8_t *dst) {
 
         //End read
         SD_Card_Command(_SD_CMD_END_READ, 0x00000000);
+        return 1;
+    }
+    return 0;
+}
+
+void SD_Card_ReadSCR(void) {
+    if((SD_Card_AppCommand(_SD_ACMD_READ_SCR, 0x00000000) == 0x00) && SD_Card_WaitStartToken()) {
+        //Read data (8 bytes)
+        uint8_t *dst = (uint8_t *)&SD_SCR + 8;
+        for(uint8_t i=0; i<8; i++) {
+            *--dst = SD_SPI_Read();
+        }
+
+        SD_Card_ProcessCRC();
+    }
+}
+
+void SD_Card_ReadSSR(void) {
+    if(SD_Card_AppCommand(_SD_ACMD_READ_SSR, 0x00000000) == 0x00) {
+        SD_SPI_Read();      //Second byte of R2 response
+        if(!SD_Card_WaitStartToken()) return;
+
+        //Read data (64 bytes), keeping only the fields used by the driver
+        for(uint8_t i=0; i<_SD_SSR_SIZE; i++) {
+            uint8_t c = SD_SPI_Read();
+            switch(i) {
+                case 8:
+                    SD_SSR.speedClass = c;
+                    break;
+                case 10:
+                    SD_SSR.auSize = c >> 4;
+                    break;
+                case 11:
+                    SD_SSR.eraseSize = (uint16_t)(c << 8);
+                    break;
+                case 12:
+                    SD_SSR.eraseSize |= c;
+                    break;
+                case 13:
+                    SD_SSR.eraseTimeout = c >> 2;
+                    SD_SSR.eraseOffset = c & 0x03;
+                    break;
+            }
+        }
+
+        SD_Card_ProcessCRC();
+
+        //Allocation unit size in bytes
+        SD_CURRENT->auBytes = (uint32_t)SD_AU_SIZE[SD_SSR.auSize] << 14;
+
+        //A write entering a new AU may have to erase it, so wait for busy as long as an AU erase: timeout / size + offset
+        if((SD_SSR.eraseSize != 0) && (SD_SSR.eraseTimeout != 0)) {
+            uint32_t timeout = ((uint32_t)SD_SSR.eraseTimeout * 1000 / SD_SSR.eraseSize) + ((uint32_t)SD_SSR.eraseOffset * 1000);
+            if(timeout > 0xFFFF) timeout = 0xFFFF;
+            if(timeout > _SD_BUSY_TIMEOUT) SD_CURRENT->busyTimeout = (uint16_t)timeout;
+        }
     }
 }
 
@@ -200,6 +293,14 @@ uint32_t SD_Card_GetSize(void) {
     return 0;
 }
 
+uint32_t SD_Card_AUAlign(uint32_t addr) {
+    //Round address up to the next allocation unit boundary
+    uint32_t au = SD_CURRENT->auBytes;
+    if(au == 0) return addr;
+    uint32_t offset = addr % au;
+    return (offset == 0) ? addr : (addr + au - offset);
+}
+
 uint16_t SD_Card_ProcessCRC(void) {
     //Read CRC (2 bytes)
     uint16_t crc = SD_SPI_Read() << 8;
@@ -212,17 +313,59 @@ uint8_t SD_Card_IsActive(void) {
 }
 
 void SD_Card_WaitIfBusy(void) {
-    for(uint8_t i=0; i<250; i++) {
+    for(uint16_t i=SD_CURRENT->busyTimeout; i!=0; i--) {
         if(SD_SPI_Read() != 0x00) return;
         __delay_ms(1);
     }
 }
 
-void SD_Card_WaitStartToken(void) {
-    for(uint8_t i=0; i<250; i++) {
-        if(SD_SPI_Read() == _SD_BLOCK_SINGLE_TOKEN) return;
-        __delay_ms(1);
+void SD_Card_Release(void) {
+    //Disable card in the middle of a session: it may be programming, and SD_Card_Resume has to select it again
+    SD_FLAGS.isCardBusy = 1;
+    SD_FLAGS.isCardReleased = 1;
+    SD_Card_Disable();
+}
+
+void SD_Card_Resume(void) {
+    //Select again a released card, and wait until it is ready
+    _SD_SPI_CS_LOW();
+    SD_Card_WaitIfBusy();
+    SD_FLAGS.isCardBusy = 0;
+    SD_FLAGS.isCardReleased = 0;
+}
+
+void SD_Card_SetWriteBehind(uint8_t enable) {
+    SD_FLAGS.writeBehind = enable;
+}
+
+uint8_t SD_Card_IsBusy(void) {
+    return SD_FLAGS.isCardBusy;
+}
+
+uint8_t SD_Card_Poll(void) {
+    //Sample the card once without blocking: it holds DO low while programming. Card stays released
+    if(SD_FLAGS.isCardBusy == 1) {
+        _SD_SPI_CS_LOW();
+        if(SD_SPI_Read() != 0x00) SD_FLAGS.isCardBusy = 0;
+        SD_Card_Disable();
     }
+    return SD_FLAGS.isCardBusy;
+}
+
+uint8_t SD_Card_IsWriteFailed(void) {
+    //Set when the card did not accept a block of the current write session
+    return SD_FLAGS.isWriteFailed;
+}
+
+uint8_t SD_Card_WaitStartToken(void) {
+    //Poll without delays, so a block is read as soon as the card has it ready.
+    //Return 1 on start token, 0 on data error token or timeout: no data block follows
+    for(uint16_t i=_SD_TOKEN_TIMEOUT; i!=0; i--) {
+        uint8_t token = SD_SPI_Read();
+        if(token == _SD_BLOCK_SINGLE_TOKEN) return 1;
+        if((token != 0x00) && ((token & _SD_BLOCK_ERROR_MASK) == 0x00)) return 0;
+    }
+    return 0;
 }
 
 uint8_t SD_Card_RWInit(uint32_t addr, uint8_t readOrWrite, uint8_t singleOrMultiBlock) {
@@ -231,6 +374,10 @@ uint8_t SD_Card_RWInit(uint32_t addr, uint8_t readOrWrite, uint8_t singleOrMulti
     //Set flags
     SD_FLAGS.readOrWrite = readOrWrite;
     SD_FLAGS.singleOrMultiBlock = singleOrMultiBlock;
+    SD_FLAGS.isBlockCountSet = 0;
+    SD_FLAGS.isMultiBlockWritten = 0;
+    SD_FLAGS.isWriteFailed = 0;
+    SD_CURRENT->addr = addr;
 
     //Initiate R/W process
     if(readOrWrite == _SD_WRITE_FLAG) {
@@ -246,12 +393,14 @@ uint8_t SD_Card_RWInit(uint32_t addr, uint8_t readOrWrite, uint8_t singleOrMulti
         }
     } else {
         if(singleOrMultiBlock == _SD_BLOCK_MULTI_FLAG) {
-            SD_Card_Command(_SD_CMD_READ_MULTI, addr);
-            return 1;
+            if(SD_Card_Command(_SD_CMD_READ_MULTI, addr) == 0x00) {
+                return 1;
+            }
         } else {
-            SD_Card_Command(_SD_CMD_READ_SINGLE, addr);
-            SD_Card_WaitStartToken();
-            return 1;
+            //A data error token instead of the start token means that no data follows
+            if((SD_Card_Command(_SD_CMD_READ_SINGLE, addr) == 0x00) && SD_Card_WaitStartToken()) {
+                return 1;
+            }
         }
     }
 
@@ -260,6 +409,35 @@ uint8_t SD_Card_RWInit(uint32_t addr, uint8_t readOrWrite, uint8_t singleOrMulti
     return 0;
 }
 
+uint8_t SD_Card_ReadInitCount(uint32_t addr, uint16_t count) {
+    //A count of 0 would look like a completed read, and RWEnd would not stop it
+    if(count == 0) return 0;
+    SD_Card_Enable();
+
+    //Set flags
+    SD_FLAGS.readOrWrite = _SD_READ_FLAG;
+    SD_FLAGS.singleOrMultiBlock = _SD_BLOCK_MULTI_FLAG;
+    SD_FLAGS.isBlockCountSet = 0;
+
+    //If supported, predefine the number of blocks so the card stops by itself, otherwise RWEnd falls back to CMD12
+    if(SD_FLAGS.cardBlockCountOK == 1) {
+        if(SD_Card_Command(_SD_CMD_SET_BLOCK_COUNT, count) == 0x00) {
+            SD_FLAGS.isBlockCountSet = 1;
+            SD_BLOCK_COUNT = count;
+        }
+    }
+
+    //Initiate multi block read
+    if(SD_Card_Command(_SD_CMD_READ_MULTI, addr) == 0x00) {
+        return 1;
+    }
+
+    //If here, initialization failed, so disable card and exit
+    SD_FLAGS.isBlockCountSet = 0;
+    SD_Card_Disable();
+    return 0;
+}
+
 uint16_t SD_Card_RWEnd(void) {
     //If single block, process CRC
     uint16_t crc = 0;
@@ -267,8 +445,34 @@ uint16_t SD_Card_RWEnd(void) {
         crc = SD_Card_ProcessCRC();
     }
 
-    //Send stop R/W block command
-    SD_Card_Command(((SD_FLAGS.readOrWrite == _SD_WRITE_FLAG) ? _SD_CMD_END_WRITE : _SD_CMD_END_READ), 0x00000000);
+    //If single block write, check data response. With write-behind release the card as soon as it is received
+    if((SD_FLAGS.readOrWrite == _SD_WRITE_FLAG) && (SD_FLAGS.singleOrMultiBlock == _SD_BLOCK_SINGLE_FLAG)) {
+        if((SD_SPI_Read() & _SD_DATA_RESPONSE_MASK) != _SD_DATA_ACCEPTED) SD_FLAGS.isWriteFailed = 1;
+        if(SD_FLAGS.writeBehind == 1) {
+            SD_Card_Release();
+            return crc;
+        }
+    }
+
+    //If the card has been released during a multi block write, select it again
+    if(SD_FLAGS.isCardReleased == 1) {
+        SD_Card_Resume();
+    }
+
+    if(SD_FLAGS.readOrWrite == _SD_WRITE_FLAG) {
+        if(SD_FLAGS.singleOrMultiBlock == _SD_BLOCK_MULTI_FLAG) {
+            //Multi block write ends only with the stop transmission token, then the card is busy while programming
+            SD_SPI_Write(_SD_BLOCK_STOP_TOKEN);
+            SD_SPI_Clock(1);
+            SD_Card_WaitIfBusy();
+        } else {
+            SD_Card_Command(_SD_CMD_END_WRITE, 0x00000000);
+        }
+    } else if((SD_FLAGS.isBlockCountSet == 0) || (SD_BLOCK_COUNT != 0)) {
+        //Send stop read command, unless a predefined-count read has already been completed
+        SD_Card_Command(_SD_CMD_END_READ, 0x00000000);
+    }
+    SD_FLAGS.isBlockCountSet = 0;
     SD_Card_Disable();
     return crc;
 }
@@ -286,36 +490,122 @@ uint8_t SD_Card_ReadBlock(uint32_t addr, uint8_t *dst) {
     return _SD_ERR_FLAG;
 }
 
+uint8_t SD_Card_ReadHead(uint32_t addr, uint8_t *dst, uint8_t len) {
+    //Only the first bytes of the block: a multi block read can be stopped by CMD12 anywhere, so the rest is never clocked in
+    uint8_t res = _SD_ERR_FLAG;
+    if(SD_Card_RWInit(addr, _SD_READ_FLAG, _SD_BLOCK_MULTI_FLAG)) {
+        if(SD_Card_RWStartMulti()) {
+            while(len-- != 0) {
+                *dst++ = SD_SPI_Read();
+            }
+            res = _SD_OK_FLAG;
+        }
+        SD_Card_RWEnd();
+    }
+    return res;
+}
+
 uint8_t SD_Card_WriteBlock(uint32_t addr, uint8_t *src) {
     if(SD_Card_RWInit(addr, _SD_WRITE_FLAG, _SD_BLOCK_SINGLE_FLAG)) {
         for(uint16_t i=0; i<_SD_BLOCK_SIZE; i++) {
             SD_SPI_Write(*src++);
         }
         SD_Card_RWEnd();
-        return _SD_OK_FLAG;
+        if(SD_FLAGS.isWriteFailed == 0) return _SD_OK_FLAG;
     }
 
-    //If here write failed
+    //If here write failed or block was rejected
     return _SD_ERR_FLAG;
 }
 
-void SD_Card_RWStartMulti(void) {
+uint8_t SD_Card_RWStartMulti(void) {
     if(SD_FLAGS.readOrWrite == _SD_WRITE_FLAG) {
+        if(SD_FLAGS.isWriteFailed == 1) {
+            return 0;                           //A block was rejected: caller has to stop the session
+        }
+        if(SD_FLAGS.isCardReleased == 1) {
+            SD_Card_Resume();                   //Select again if released by write-behind
+        }
+
+        //Do not let a multi block write straddle an allocation unit: end it and start a new one on the boundary
+        if((SD_FLAGS.isMultiBlockWritten == 1) && (SD_CURRENT->auBytes != 0) && ((SD_CURRENT->addr % SD_CURRENT->auBytes) == 0)) {
+            uint32_t addr = SD_CURRENT->addr;
+            SD_Card_RWEnd();
+            if(!SD_Card_RWInit(addr, _SD_WRITE_FLAG, _SD_BLOCK_MULTI_FLAG)) {
+                return 0;                       //Card is disabled: caller has to stop the session
+            }
+        }
+
         SD_Card_WaitIfBusy();                   //Wait if busy
         SD_SPI_Write(_SD_BLOCK_MULTI_TOKEN);    //Send start token
-    } else {
-        SD_Card_WaitStartToken();
+        return 1;
     }
+    return SD_Card_WaitStartToken();
 }
 
 uint16_t SD_Card_RWStopMulti(void) {
     uint16_t crc = SD_Card_ProcessCRC();
 
-    //If write, then check data response
+    //If write, then check data response: it follows the CRC
     if(SD_FLAGS.readOrWrite == _SD_WRITE_FLAG) {
-        SD_SPI_Clock(1);
-        SD_SPI_Read();
+        if((SD_SPI_Read() & _SD_DATA_RESPONSE_MASK) != _SD_DATA_ACCEPTED) SD_FLAGS.isWriteFailed = 1;
+        SD_FLAGS.isMultiBlockWritten = 1;
+        SD_CURRENT->addr += _SD_BLOCK_SIZE;
+
+        //If write-behind, release the card while it programs the block
+        if(SD_FLAGS.writeBehind == 1) {
+            SD_Card_Release();
+        }
+    } else if(SD_FLAGS.isBlockCountSet == 1) {
+        SD_BLOCK_COUNT--;
+    }
+
+    return crc;
+}
+
+uint8_t SD_Stripe_Init(SD_CARD *a, SD_CARD *b, uint32_t addr) {
+    SD_STRIPE.card[0] = a;
+    SD_STRIPE.card[1] = b;
+    SD_STRIPE.next = 0;
+
+    //Open a multi block write session on both cards. With write-behind each card is released after every block,
+    //so one card programs while the other one receives data
+    for(uint8_t i=0; i<2; i++) {
+        SD_Card_Select(SD_STRIPE.card[i]);
+        SD_Card_SetWriteBehind(1);
+        if(!SD_Card_RWInit(addr, _SD_WRITE_FLAG, _SD_BLOCK_MULTI_FLAG)) {
+            SD_Card_SetWriteBehind(0);
+            //If here, second card failed, so close the session on the first one
+            if(i == 1) {
+                SD_Card_Select(SD_STRIPE.card[0]);
+                SD_Card_RWEnd();
+                SD_Card_SetWriteBehind(0);
+            }
+            return 0;
+        }
+        SD_Card_Release();
     }
 
+    return 1;
+}
+
+uint8_t SD_Stripe_StartBlock(void) {
+    //Even blocks go to the first card, odd blocks to the second one, at the same position
+    SD_Card_Select(SD_STRIPE.card[SD_STRIPE.next]);
+    return SD_Card_RWStartMulti();
+}
+
+uint16_t SD_Stripe_StopBlock(void) {
+    uint16_t crc = SD_Card_RWStopMulti();
+    SD_STRIPE.next ^= 1;
     return crc;
+}
+
+void SD_Stripe_End(void) {
+    for(uint8_t i=0; i<2; i++) {
+        SD_Card_Select(SD_STRIPE.card[i]);
+        SD_Card_RWEnd();
+        SD_Card_SetWriteBehind(0);
+    }
+    SD_Card_Select(SD_STRIPE.card[0]);
 }
\ No newline at end of file
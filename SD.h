@@ -1,5 +1,5 @@
 /*
- * 20190412.074
+ * 20261019.078
  * SD Card
  *
  * File: SPI.h
@@ -12,7 +12,12 @@
 
 #include "commons.h"
 
-#define _SD_SPI_CS      PORTAbits.RA4   //SPI CS
+#define _SD_SPI_CS_RA4          0x10    //SPI CS, default card
+#ifdef _SD_RA5_CS
+#define _SD_SPI_CS_RA5          0x20    //SPI CS, second card or export wiring (RA5 is the led otherwise, see commons.h)
+#endif
+#define _SD_SPI_CS_LOW()        (LATA &= (uint8_t)~SD_CURRENT->csMask)
+#define _SD_SPI_CS_HIGH()       (LATA |= SD_CURRENT->csMask)
 
 #define _SD_CMD_RESET           0
 #define _SD_CMD_INIT            1
@@ -24,30 +29,50 @@
 #define _SD_CMD_SET_BLOCKLEN    16
 #define _SD_CMD_READ_SINGLE     17
 #define _SD_CMD_READ_MULTI      18
+#define _SD_CMD_SET_BLOCK_COUNT 23
 #define _SD_CMD_WRITE_SINGLE    24
 #define _SD_CMD_WRITE_MULTI     25
+#define _SD_CMD_APP             55
+#define _SD_ACMD_READ_SSR       13
+#define _SD_ACMD_READ_SCR       51
 
 #define _SD_OK_FLAG                 0
 #define _SD_ERR_FLAG                1
 #define _SD_READ_FLAG               0
 #define _SD_WRITE_FLAG              1
 #define _SD_BLOCK_SIZE              512
+#define _SD_MAX_SECTOR              0x007FFFFF  //Last sector reachable with 32 bit byte addresses
 #define _SD_BLOCK_SINGLE_FLAG       0
 #define _SD_BLOCK_MULTI_FLAG        1
 #define _SD_BLOCK_SINGLE_TOKEN      0xFE
 #define _SD_BLOCK_MULTI_TOKEN       0xFC
+#define _SD_BLOCK_STOP_TOKEN        0xFD
+#define _SD_DATA_RESPONSE_MASK      0x1F
+#define _SD_DATA_ACCEPTED           0x05    //Data response: xxx00101
+#define _SD_BLOCK_ERROR_MASK        0xF0    //Data error token: 0000XXXX
+#define _SD_SCR_CMD23_SUPPORT       0x02
+#define _SD_SSR_SIZE                64
+#define _SD_BUSY_TIMEOUT            250     //Default busy timeout (ms)
+#define _SD_TOKEN_TIMEOUT           0xFFFF  //Start token polls: about 1s at FOSC / 64, 260ms at FOSC / 16
 
-struct {
-    unsigned unused : 2;
+typedef struct {
+    unsigned unused : 3;
+    unsigned isWriteFailed : 1;
+    unsigned isCardReleased : 1;
+    unsigned isMultiBlockWritten : 1;
+    unsigned isCardBusy : 1;
+    unsigned writeBehind : 1;
+    unsigned isBlockCountSet : 1;
+    unsigned cardBlockCountOK : 1;
     unsigned readOrWrite : 1;
     unsigned singleOrMultiBlock : 1;
     unsigned cardBlockSizeOK : 1;
     unsigned cardResetOK : 1;
     unsigned cardInitOK : 1;
     unsigned isCardActive : 1;
-} SD_FLAGS;
+} _SD_FLAGS;
 
-struct {
+typedef struct {
     //byte 15
     unsigned end : 1;
     unsigned crc : 7;
@@ -64,7 +89,7 @@ struct {
     uint16_t oemid;
     //byte 0
     uint8_t manfid;
-} SD_CID;
+} _SD_CID;
 
 typedef struct {
     //byte 15
@@ -182,35 +207,112 @@ typedef struct {
     unsigned csd_ver : 2;
 } _SD_CSDv2;
 
-union {
+typedef union {
     _SD_CSDv1 v1;
     _SD_CSDv2 v2;
-} SD_CSD;
+} _SD_CSD;
+
+typedef struct {
+    //byte 4-7
+    uint32_t reserved3;
+    //byte 3
+    unsigned cmd_support : 4;
+    unsigned reserved2 : 2;
+    unsigned sd_specx_low : 2;
+    //byte 2
+    unsigned sd_specx_high : 2;
+    unsigned sd_spec4 : 1;
+    unsigned ex_security : 4;
+    unsigned sd_spec3 : 1;
+    //byte 1
+    unsigned sd_bus_widths : 4;
+    unsigned sd_security : 3;
+    unsigned data_stat_after_erase : 1;
+    //byte 0
+    unsigned sd_spec : 4;
+    unsigned scr_structure : 4;
+} _SD_SCR;
+
+typedef struct {
+    uint8_t speedClass;     //0: class 0, 1: class 2, 2: class 4, 3: class 6, 4: class 10
+    uint8_t auSize;         //Allocation unit size code (0: not defined, 1: 16KB ... 15: 64MB)
+    uint16_t eraseSize;     //Number of AUs erased in eraseTimeout
+    uint8_t eraseTimeout;   //Seconds
+    uint8_t eraseOffset;    //Seconds
+} _SD_SSR;
+
+typedef struct {
+    _SD_FLAGS flags;
+    _SD_CID cid;
+    _SD_CSD csd;
+    _SD_SCR scr;
+    _SD_SSR ssr;
+    uint32_t auBytes;       //Allocation unit size in bytes, 0 if unknown
+    uint32_t addr;          //Next block address of a multi block write
+    uint16_t busyTimeout;   //Busy timeout (ms)
+    uint16_t blockCount;    //Blocks left in a predefined-count (CMD23) multi block read
+    uint8_t csMask;         //CS pin mask on PORTA
+} SD_CARD;
+
+typedef struct {
+    SD_CARD *card[2];
+    uint8_t next;           //Card receiving the next block
+} _SD_STRIPE;
+
+SD_CARD SD_CARD0;           //Default card, CS on RA4
+SD_CARD *SD_CURRENT;        //Card addressed by the SD_Card functions
+_SD_STRIPE SD_STRIPE;
+
+#define SD_FLAGS        (SD_CURRENT->flags)
+#define SD_CID          (SD_CURRENT->cid)
+#define SD_CSD          (SD_CURRENT->csd)
+#define SD_SCR          (SD_CURRENT->scr)
+#define SD_SSR          (SD_CURRENT->ssr)
+#define SD_BLOCK_COUNT  (SD_CURRENT->blockCount)
 
 void SD_SPI_Init(void);
 void SD_SPI_Clock(uint8_t count);
 uint8_t SD_SPI_Write(uint8_t byte);
 uint8_t SD_SPI_Read(void);
 
+void SD_Card_Setup(SD_CARD *card, uint8_t csMask);
+void SD_Card_Select(SD_CARD *card);
 void SD_Card_Enable(void);
 void SD_Card_Disable(void);
 uint8_t SD_Card_Command(uint8_t cmd, uint32_t arg);
+uint8_t SD_Card_AppCommand(uint8_t cmd, uint32_t arg);
 uint8_t SD_Card_Crc7(uint8_t crc, uint8_t *data, uint8_t len);
 uint16_t SD_Card_Crc16(uint16_t crc, uint8_t *data, uint16_t len);
 uint16_t SD_Card_Crc16Byte(uint16_t crc, uint8_t c);
 void SD_Card_Init(void);
-void SD_Card_ReadReg16(uint8_t reg, uint8_t *dst);
+uint8_t SD_Card_ReadReg16(uint8_t reg, uint8_t *dst);
+void SD_Card_ReadSCR(void);
+void SD_Card_ReadSSR(void);
 uint32_t SD_Card_GetSize(void);
+uint32_t SD_Card_AUAlign(uint32_t addr);
 uint16_t SD_Card_ProcessCRC(void);
 uint8_t SD_Card_IsActive(void);
 void SD_Card_WaitIfBusy(void);
-void SD_Card_WaitStartToken(void);
+void SD_Card_Release(void);
+void SD_Card_Resume(void);
+void SD_Card_SetWriteBehind(uint8_t enable);
+uint8_t SD_Card_IsBusy(void);
+uint8_t SD_Card_Poll(void);
+uint8_t SD_Card_IsWriteFailed(void);
+uint8_t SD_Card_WaitStartToken(void);
 
 uint8_t SD_Card_RWInit(uint32_t addr, uint8_t readOrWrite, uint8_t singleOrMultiBlock);
+uint8_t SD_Card_ReadInitCount(uint32_t addr, uint16_t count);
 uint16_t SD_Card_RWEnd(void);
 uint8_t SD_Card_ReadBlock(uint32_t addr, uint8_t *dst);
+uint8_t SD_Card_ReadHead(uint32_t addr, uint8_t *dst, uint8_t len);
 uint8_t SD_Card_WriteBlock(uint32_t addr, uint8_t *src);
-void SD_Card_RWStartMulti(void);
+uint8_t SD_Card_RWStartMulti(void);
 uint16_t SD_Card_RWStopMulti(void);
 
+uint8_t SD_Stripe_Init(SD_CARD *a, SD_CARD *b, uint32_t addr);
+uint8_t SD_Stripe_StartBlock(void);
+uint16_t SD_Stripe_StopBlock(void);
+void SD_Stripe_End(void);
+
 #endif
\ No newline at end of file
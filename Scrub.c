@@ -0,0 +1,105 @@
+/*
+ * 20261019.001
+ * SD Card
+ *
+ * File: Scrub.c
+ * Processor: PIC12F1840
+ * Author: wizlab.it
+ */
+
+#include "Scrub.h"
+
+uint8_t SD_Scrub_Init(uint32_t first, uint32_t count) {
+    SD_SCRUB.start = first;
+    SD_SCRUB.next = first;
+    SD_SCRUB.end = first;
+    SD_SCRUB.verified = 0;
+    SD_SCRUB.ticks = 0;
+    SD_SCRUB.badCount = 0;
+    SD_SCRUB.lost = 0;
+
+    //Sectors past the limit cannot be addressed: the byte address would wrap and verify the wrong sectors
+    if((first > _SD_MAX_SECTOR) || (count > (_SD_MAX_SECTOR - first + 1))) return _SD_ERR_FLAG;
+    SD_SCRUB.end = first + count;
+    return _SD_OK_FLAG;
+}
+
+uint8_t SD_Scrub_Run(uint8_t slice) {
+    if(SD_SCRUB.next >= SD_SCRUB.end) return 0;
+
+    //Read up to the end of the range with a single multi block read, stopped early when the time slice is over
+    uint32_t count = SD_SCRUB.end - SD_SCRUB.next;
+    if(count > 0xFFFF) count = 0xFFFF;
+    uint8_t elapsed = 0;
+    TMR0IF = 0;
+
+    if(!SD_Card_ReadInitCount(SD_SCRUB.next * _SD_BLOCK_SIZE, (uint16_t)count)) {
+        //If here, read could not be started, so mark the sector as bad and go on with the next one
+        SD_Scrub_Bad(SD_SCRUB.next++);
+        return (SD_SCRUB.next < SD_SCRUB.end);
+    }
+
+    for(; count!=0; count--) {
+        //Verify block against the card CRC
+        uint16_t crc = 0;
+        if(!SD_Card_RWStartMulti()) {
+            //If here, card sent a data error token, so no block follows: mark the sector and restart after it
+            SD_Scrub_Bad(SD_SCRUB.next++);
+            SD_SCRUB.verified++;
+            break;
+        }
+        for(uint16_t i=0; i<_SD_BLOCK_SIZE; i++) {
+            crc = SD_Card_Crc16Byte(crc, SD_SPI_Read());
+            if(TMR0IF) {
+                TMR0IF = 0;
+                elapsed++;
+            }
+        }
+        if(crc != SD_Card_RWStopMulti()) SD_Scrub_Bad(SD_SCRUB.next);
+        SD_SCRUB.next++;
+        SD_SCRUB.verified++;
+
+        //Yield when the time slice is over
+        if(elapsed >= slice) break;
+    }
+
+    SD_Card_RWEnd();
+    SD_SCRUB.ticks += elapsed;
+    return (SD_SCRUB.next < SD_SCRUB.end);
+}
+
+void SD_Scrub_Bad(uint32_t sector) {
+    //Extend the last range if contiguous, otherwise record a new one
+    if(SD_SCRUB.badCount != 0) {
+        _SD_SCRUB_RANGE *last = &SD_SCRUB.bad[SD_SCRUB.badCount - 1];
+        if(((last->start + last->count) == sector) && (last->count != 0xFFFF)) {
+            last->count++;
+            return;
+        }
+    }
+    if(SD_SCRUB.badCount < _SD_SCRUB_BAD_RANGES) {
+        SD_SCRUB.bad[SD_SCRUB.badCount].start = sector;
+        SD_SCRUB.bad[SD_SCRUB.badCount].count = 1;
+        SD_SCRUB.badCount++;
+    } else if(SD_SCRUB.lost != 0xFF) {
+        SD_SCRUB.lost++;
+    }
+}
+
+uint8_t SD_Scrub_Progress(void) {
+    //Percentage of the range verified
+    uint32_t total = SD_SCRUB.end - SD_SCRUB.start;
+    uint32_t done = SD_SCRUB.next - SD_SCRUB.start;
+    if(total == 0) return 100;
+    while(total > 0x00FFFFFF) {
+        total >>= 8;
+        done >>= 8;
+    }
+    return (uint8_t)((done * 100) / total);
+}
+
+uint32_t SD_Scrub_Rate(void) {
+    //Sectors verified per second
+    if(SD_SCRUB.ticks == 0) return 0;
+    return (SD_SCRUB.verified * _SD_SCRUB_TICKS_PER_SECOND) / SD_SCRUB.ticks;
+}
\ No newline at end of file
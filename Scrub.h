@@ -0,0 +1,45 @@
+/*
+ * 20261019.001
+ * SD Card
+ *
+ * File: Scrub.h
+ * Processor: PIC12F1840
+ * Author: wizlab.it
+ *
+ * Resumable verification of a sector range: every block read is checked
+ * against the CRC16 sent by the card. Time is measured in Timer0 overflows
+ * (FOSC / 4 / 256 / 256: about 8.2ms, 122 per second), see init().
+ * The range must end at or before _SD_MAX_SECTOR.
+ */
+
+#ifndef SCRUB_H
+#define	SCRUB_H
+
+#include "commons.h"
+
+#define _SD_SCRUB_BAD_RANGES            4
+#define _SD_SCRUB_TICKS_PER_SECOND      122
+
+typedef struct {
+    uint32_t start;         //First bad sector
+    uint16_t count;         //Consecutive bad sectors
+} _SD_SCRUB_RANGE;
+
+struct {
+    uint32_t start;         //First sector of the range
+    uint32_t next;          //Next sector to verify
+    uint32_t end;           //First sector after the range
+    uint32_t verified;      //Sectors verified
+    uint32_t ticks;         //Timer0 overflows spent verifying
+    uint8_t badCount;       //Bad ranges recorded
+    uint8_t lost;           //Bad ranges not recorded because the list was full
+    _SD_SCRUB_RANGE bad[_SD_SCRUB_BAD_RANGES];
+} SD_SCRUB;
+
+uint8_t SD_Scrub_Init(uint32_t first, uint32_t count);
+uint8_t SD_Scrub_Run(uint8_t slice);
+void SD_Scrub_Bad(uint32_t sector);
+uint8_t SD_Scrub_Progress(void);
+uint32_t SD_Scrub_Rate(void);
+
+#endif
\ No newline at end of file
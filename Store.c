@@ -0,0 +1,249 @@
+/*
+ * 20261019.001
+ * SD Card
+ *
+ * File: Store.c
+ * Processor: PIC12F1840
+ * Author: wizlab.it
+ */
+
+#include "Store.h"
+
+uint8_t SD_Store_Open(uint32_t base) {
+    uint32_t magic = 0;
+    uint8_t *p = (uint8_t *)&magic;
+    uint16_t size = 0;
+    uint8_t version = 0;
+
+    SD_STORE.base = base;
+    SD_STORE.data = 0;
+    SD_STORE.count = 0;
+    if(base >= _SD_STORE_MAX_SECTOR) return _SD_ERR_FLAG;
+
+    //Read header: if valid, appending restarts after the last record
+    if(SD_Card_RWInit(base * _SD_BLOCK_SIZE, _SD_READ_FLAG, _SD_BLOCK_SINGLE_FLAG)) {
+        for(uint16_t i=0; i<_SD_BLOCK_SIZE; i++) {
+            uint8_t c = SD_SPI_Read();
+            if(i < 4) {
+                *(p + 3 - i) = c;
+            } else if(i < 6) {
+                size = (size << 8) | c;
+            } else if(i == 6) {
+                version = c;
+            } else if(i < 11) {
+                SD_STORE.count = (SD_STORE.count << 8) | c;
+            } else if(i < 15) {
+                SD_STORE.data = (SD_STORE.data << 8) | c;
+            }
+        }
+        SD_Card_RWEnd();
+    }
+
+    //Header must be valid and of this layout, and its records must be reachable
+    if((magic != _SD_STORE_MAGIC) || (size != _SD_STORE_RECORD_SIZE) || (version != _SD_STORE_VERSION)
+            || (SD_STORE.data <= base) || (SD_STORE.data > _SD_STORE_MAX_SECTOR)
+            || ((SD_STORE.count != 0) && (SD_Store_Sector(SD_STORE.count - 1) > _SD_STORE_MAX_SECTOR))) {
+        //New store: data from the next AU boundary, so appends never start inside an AU written before.
+        //Near the end of the card there may be no boundary left
+        SD_STORE.data = SD_Card_AUAlign((base + 1) * _SD_BLOCK_SIZE) / _SD_BLOCK_SIZE;
+        if(SD_STORE.data <= base) SD_STORE.data = base + 1;
+        SD_STORE.count = 0;
+        return _SD_ERR_FLAG;
+    }
+    return _SD_OK_FLAG;
+}
+
+uint32_t SD_Store_Sector(uint32_t record) {
+    return SD_STORE.data + (record / _SD_STORE_RECORDS_PER_BLOCK);
+}
+
+uint8_t SD_Store_Begin(void) {
+    //Records are always appended from a block boundary, see SD_Store_End
+    if(SD_Store_Sector(SD_STORE.count) > _SD_STORE_MAX_SECTOR) return 0;
+    return SD_Card_RWInit(SD_Store_Sector(SD_STORE.count) * _SD_BLOCK_SIZE, _SD_WRITE_FLAG, _SD_BLOCK_MULTI_FLAG);
+}
+
+void SD_Store_End(void) {
+    //Fill the block with unused records, so next append starts on a block boundary
+    while((SD_STORE.count % _SD_STORE_RECORDS_PER_BLOCK) != 0) {
+        if(SD_Store_Append(0) != _SD_OK_FLAG) break;
+    }
+    SD_Card_RWEnd();
+    SD_Store_WriteHeader();
+}
+
+uint8_t SD_Store_Append(const uint8_t *rec) {
+    uint8_t r = (uint8_t)(SD_STORE.count % _SD_STORE_RECORDS_PER_BLOCK);
+
+    //Start of block: it must fit
+    if(r == 0) {
+        if(SD_Store_Sector(SD_STORE.count) > _SD_STORE_MAX_SECTOR) return _SD_ERR_FLAG;
+        if(!SD_Card_RWStartMulti()) return _SD_ERR_FLAG;
+    }
+
+    //Write record, or an unused one
+    for(uint8_t i=0; i<_SD_STORE_RECORD_SIZE; i++) {
+        SD_SPI_Write((rec != 0) ? *rec++ : 0xFF);
+    }
+    SD_STORE.count++;
+
+    //End of block
+    if(r == (_SD_STORE_RECORDS_PER_BLOCK - 1)) {
+        for(uint16_t i=(_SD_STORE_RECORDS_PER_BLOCK * _SD_STORE_RECORD_SIZE); i<_SD_BLOCK_SIZE; i++) {
+            SD_SPI_Write(0xFF);
+        }
+        SD_Card_RWStopMulti();
+    }
+
+    return _SD_OK_FLAG;
+}
+
+void SD_Store_WriteHeader(void) {
+    if(SD_Card_RWInit(SD_STORE.base * _SD_BLOCK_SIZE, _SD_WRITE_FLAG, _SD_BLOCK_SINGLE_FLAG)) {
+        uint32_t magic = _SD_STORE_MAGIC;
+        uint8_t *p = (uint8_t *)&magic;
+        SD_SPI_Write(*(p + 3));
+        SD_SPI_Write(*(p + 2));
+        SD_SPI_Write(*(p + 1));
+        SD_SPI_Write(*p);
+        SD_SPI_Write(0);
+        SD_SPI_Write(_SD_STORE_RECORD_SIZE);
+        SD_SPI_Write(_SD_STORE_VERSION);
+        p = (uint8_t *)&SD_STORE.count;
+        SD_SPI_Write(*(p + 3));
+        SD_SPI_Write(*(p + 2));
+        SD_SPI_Write(*(p + 1));
+        SD_SPI_Write(*p);
+        p = (uint8_t *)&SD_STORE.data;
+        SD_SPI_Write(*(p + 3));
+        SD_SPI_Write(*(p + 2));
+        SD_SPI_Write(*(p + 1));
+        SD_SPI_Write(*p);
+        for(uint16_t i=15; i<_SD_BLOCK_SIZE; i++) {
+            SD_SPI_Write(0xFF);
+        }
+        SD_Card_RWEnd();
+    }
+}
+
+uint32_t SD_Store_Find(uint32_t t) {
+    uint32_t blocks = (SD_STORE.count + _SD_STORE_RECORDS_PER_BLOCK - 1) / _SD_STORE_RECORDS_PER_BLOCK;
+    if(blocks == 0) return 0;
+
+    //Search of the last block starting strictly before t (records at t may start in the previous block)
+    uint32_t lo = 0;
+    uint32_t hi = blocks - 1;
+    uint32_t tsLo = SD_Store_BlockFirst(lo);
+    if(tsLo >= t) return 0;
+    uint32_t tsHi = SD_Store_BlockFirst(hi);
+    if(tsHi < t) return hi * _SD_STORE_RECORDS_PER_BLOCK;
+
+    //Here block lo starts before t, block hi at or after t. Guess by interpolation of the timestamps,
+    //but bisect after a guess that did not halve the range, so uneven timestamps cost at most twice a binary search
+    uint8_t guess = 1;
+    while((hi - lo) > 1) {
+        uint32_t width = hi - lo;
+        uint32_t mid;
+        if(guess == 1) {
+            mid = lo + SD_Store_Interpolate(t - tsLo, tsHi - tsLo, width);
+        } else {
+            mid = lo + (width >> 1);
+        }
+        if(mid <= lo) mid = lo + 1;
+        if(mid >= hi) mid = hi - 1;
+
+        uint32_t ts = SD_Store_BlockFirst(mid);
+        if(ts < t) {
+            lo = mid;
+            tsLo = ts;
+        } else {
+            hi = mid;
+            tsHi = ts;
+        }
+        guess = (guess == 0) || ((hi - lo) <= (width >> 1));
+    }
+    return lo * _SD_STORE_RECORDS_PER_BLOCK;
+}
+
+uint32_t SD_Store_BlockFirst(uint32_t block) {
+    //First timestamp of a data block: 4 bytes, the rest of the block is not read
+    uint32_t ts = _SD_STORE_EMPTY;
+    SD_Card_ReadHead((SD_STORE.data + block) * _SD_BLOCK_SIZE, (uint8_t *)&ts, 4);
+    return ts;
+}
+
+uint32_t SD_Store_Interpolate(uint32_t num, uint32_t den, uint32_t n) {
+    //n * num / den, with num <= den. Bit by bit, as the product does not fit 32 bits
+    uint32_t q = 0;
+    uint32_t rem = 0;
+    if(den > 0x7FFFFFFF) {
+        num >>= 1;
+        den >>= 1;
+    }
+    for(uint8_t i=0; i<32; i++) {
+        q <<= 1;
+        rem <<= 1;
+        if(rem >= den) {
+            q++;
+            rem -= den;
+        }
+        if((n & 0x80000000) != 0) {
+            rem += num;
+            if(rem >= den) {
+                q++;
+                rem -= den;
+            }
+        }
+        n <<= 1;
+    }
+    return q;
+}
+
+uint8_t SD_Store_ReadBegin(uint32_t record) {
+    //Reading starts at the beginning of the block holding the record
+    record -= record % _SD_STORE_RECORDS_PER_BLOCK;
+    if(record >= SD_STORE.count) return 0;
+    SD_STORE.record = record;
+
+    //Stream up to the end of the store with a single multi block read.
+    //If too long for a predefined count, read until stopped by SD_Store_ReadEnd
+    uint32_t blocks = SD_Store_Sector(SD_STORE.count - 1) + 1 - SD_Store_Sector(record);
+    if(blocks > 0xFFFF) {
+        return SD_Card_RWInit(SD_Store_Sector(record) * _SD_BLOCK_SIZE, _SD_READ_FLAG, _SD_BLOCK_MULTI_FLAG);
+    }
+    return SD_Card_ReadInitCount(SD_Store_Sector(record) * _SD_BLOCK_SIZE, (uint16_t)blocks);
+}
+
+uint8_t SD_Store_Read(uint8_t *rec) {
+    while(SD_STORE.record < SD_STORE.count) {
+        uint8_t r = (uint8_t)(SD_STORE.record % _SD_STORE_RECORDS_PER_BLOCK);
+
+        //Start of block
+        if((r == 0) && !SD_Card_RWStartMulti()) return _SD_ERR_FLAG;
+
+        //Read record
+        uint8_t *dst = rec;
+        for(uint8_t i=0; i<_SD_STORE_RECORD_SIZE; i++) {
+            *dst++ = SD_SPI_Read();
+        }
+        SD_STORE.record++;
+
+        //End of block: skip padding
+        if(r == (_SD_STORE_RECORDS_PER_BLOCK - 1)) {
+            for(uint16_t i=(_SD_STORE_RECORDS_PER_BLOCK * _SD_STORE_RECORD_SIZE); i<_SD_BLOCK_SIZE; i++) {
+                SD_SPI_Read();
+            }
+            SD_Card_RWStopMulti();
+        }
+
+        //Skip unused records
+        if(*(uint32_t *)rec != _SD_STORE_EMPTY) return _SD_OK_FLAG;
+    }
+
+    //If here, end of store
+    return _SD_ERR_FLAG;
+}
+
+void SD_Store_ReadEnd(void) {
+    SD_Card_RWEnd();
+}
\ No newline at end of file
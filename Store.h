@@ -0,0 +1,52 @@
+/*
+ * 20261019.001
+ * SD Card
+ *
+ * File: Store.h
+ * Processor: PIC12F1840
+ * Author: wizlab.it
+ *
+ * Fixed size, time ordered records over raw sectors. Starting from the base sector:
+ *  - header sector: _SD_STORE_MAGIC (4 bytes), record size (2 bytes), _SD_STORE_VERSION (1 byte),
+ *    record count (4 bytes), first data sector (4 bytes)
+ *  - then contiguous data blocks from the next AU boundary, up to _SD_STORE_MAX_SECTOR
+ * A data block holds _SD_STORE_RECORDS_PER_BLOCK records, the first 4 bytes of each record
+ * are its timestamp. There are no index blocks: the first timestamp of each data block is the
+ * index, and SD_Store_Find reads just those 4 bytes of the blocks it probes. Record position is
+ * pure arithmetic, see SD_Store_Sector. Unused records at the end of a block have timestamp
+ * _SD_STORE_EMPTY and are skipped when reading.
+ */
+
+#ifndef STORE_H
+#define	STORE_H
+
+#include "commons.h"
+
+#define _SD_STORE_MAGIC                 0x53445253  //"SDRS"
+#define _SD_STORE_VERSION               2           //Byte 6 held the group blocks (4) in the layout with index blocks
+#define _SD_STORE_RECORD_SIZE           16
+#define _SD_STORE_RECORDS_PER_BLOCK     (_SD_BLOCK_SIZE / _SD_STORE_RECORD_SIZE)
+#define _SD_STORE_EMPTY                 0xFFFFFFFF
+#define _SD_STORE_MAX_SECTOR            _SD_MAX_SECTOR
+
+struct {
+    uint32_t base;                              //Header sector
+    uint32_t data;                              //First data sector
+    uint32_t count;                             //Records in store, including unused ones
+    uint32_t record;                            //Next record to read
+} SD_STORE;
+
+uint8_t SD_Store_Open(uint32_t base);
+uint32_t SD_Store_Sector(uint32_t record);
+uint8_t SD_Store_Begin(void);
+uint8_t SD_Store_Append(const uint8_t *rec);
+void SD_Store_End(void);
+void SD_Store_WriteHeader(void);
+uint32_t SD_Store_Find(uint32_t t);
+uint32_t SD_Store_BlockFirst(uint32_t block);
+uint32_t SD_Store_Interpolate(uint32_t num, uint32_t den, uint32_t n);
+uint8_t SD_Store_ReadBegin(uint32_t record);
+uint8_t SD_Store_Read(uint8_t *rec);
+void SD_Store_ReadEnd(void);
+
+#endif
\ No newline at end of file
@@ -16,7 +16,13 @@
 
 #define _XTAL_FREQ 32000000     //CPU Frequency
 
+//RA5 drives either the led or a card CS (second card for striping, or the card itself for export).
+//Builds using it as CS define _SD_RA5_CS: then _LED is not defined, so code driving the led does not build,
+//and without _SD_RA5_CS there is no _SD_SPI_CS_RA5 to select a card with. A second card is set up (SD_Card_Setup)
+//right after SD_SPI_Init, so its CS is high before the first card is clocked
+#ifndef _SD_RA5_CS
 #define _LED    PORTAbits.RA5   //Led
+#endif
 
 //External functions
 extern void init(void);
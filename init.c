@@ -37,7 +37,7 @@ void init(void) {
     /*
     * PORT A
     *  - RA[7-6]: 00 (Not implemented)
-    *  - RA[5]: 0 (Output, Led 1)
+    *  - RA[5]: 0 (Output, Led 1, or card CS if built with _SD_RA5_CS)
     *  - RA[4]: 0 (Output, SPI CS)
     *  - RA[3]: 1 (Input, Unused)
     *  - RA[2]: 1 (Input, SPI SDI)
@@ -1,5 +1,5 @@
 /*
- * 20190412.028
+ * 20261019.029
  * SD Card
  *
  * File: main.c
@@ -120,7 +120,7 @@ void loop(void) {
     //Write 1 multi block
     if(SD_Card_RWInit(0x00000A00, _SD_WRITE_FLAG, _SD_BLOCK_MULTI_FLAG)) {
         for(uint8_t j=0x10; j<0x15; j++) {
-            SD_Card_RWStartMulti();
+            if(!SD_Card_RWStartMulti()) break;
             for(uint16_t i=0; i<_SD_BLOCK_SIZE; i++) {
                 SD_SPI_Write(j);
             }
@@ -141,7 +141,7 @@ void loop(void) {
     //Write 1 multi block (4 sectors) then multiread the 2 central sectors and calculate the sum (2578)
     if(SD_Card_RWInit(0x0000B000, _SD_WRITE_FLAG, _SD_BLOCK_MULTI_FLAG)) {
         for(uint8_t j=1; j<10; j++) {
-            SD_Card_RWStartMulti();
+            if(!SD_Card_RWStartMulti()) break;
             SD_SPI_Write(0x04);
             for(uint16_t i=0; i<(_SD_BLOCK_SIZE - 2); i++) {
                 SD_SPI_Write(j);
@@ -153,7 +153,7 @@ void loop(void) {
     }
 
     uint16_t sum2 = 0;
-    if(SD_Card_RWInit(0x0000B200, _SD_READ_FLAG, _SD_BLOCK_MULTI_FLAG)) {
+    if(SD_Card_ReadInitCount(0x0000B200, 2)) {
         for(uint8_t j=0; j<2; j++) {
             SD_Card_RWStartMulti();
             for(uint16_t i=0; i<_SD_BLOCK_SIZE; i++) {
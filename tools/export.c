@@ -0,0 +1,181 @@
+/*
+ * 20261019.001
+ * SD Card
+ *
+ * File: export.c
+ * Host receiver for sectors sent by Export.c
+ * Author: wizlab.it
+ *
+ * Build: cc -o export tools/export.c
+ * Usage: export <serial device> <output image> <first sector> <sector count>
+ * Sectors are written at their position in the output image. On a bad frame or
+ * CRC the transfer is aborted, and requested again from the first missing sector.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <termios.h>
+#include <sys/select.h>
+
+#define BLOCK_SIZE      512
+#define REQUEST         0x52
+#define SYNC            0x7E
+#define END_SECTOR      0xFFFFFFFFUL
+#define MAX_SECTOR      0x007FFFFFUL
+#define MAX_COUNT       0xFFFF
+#define TIMEOUT_MS      2000
+#define DRAIN_MS        50      //Idle line that ends a drain, longer than the PIC request timeout (see Export.h)
+#define ABORT           0x00
+#define MAX_RETRIES     10
+#define RX_GAP_US       100     //Idle line after every request byte, see Export.h
+
+static uint16_t crc16(const uint8_t *data, int len) {
+    uint16_t crc = 0;
+    for(int i=0; i<len; i++) {
+        crc ^= (uint16_t)(data[i] << 8);
+        for(int j=0; j<8; j++) crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+    }
+    return crc;
+}
+
+static int readFull(int fd, uint8_t *dst, int len, int timeoutMs) {
+    while(len > 0) {
+        fd_set set;
+        struct timeval tv = { timeoutMs / 1000, (timeoutMs % 1000) * 1000 };
+        FD_ZERO(&set);
+        FD_SET(fd, &set);
+        if(select(fd + 1, &set, NULL, NULL, &tv) <= 0) return -1;
+        ssize_t n = read(fd, dst, (size_t)len);
+        if(n <= 0) return -1;
+        dst += n;
+        len -= (int)n;
+    }
+    return 0;
+}
+
+static uint32_t be32(const uint8_t *p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static int sendRequest(int fd, uint32_t sector, uint16_t count) {
+    //Every request bit is sent as a whole byte: 0x00 for 0, 0xFF for 1
+    uint8_t req[7] = { REQUEST, sector >> 24, sector >> 16, sector >> 8, sector, count >> 8, count };
+    uint8_t bits[sizeof(req) * 8];
+    for(int i=0; i<(int)sizeof(bits); i++) bits[i] = ((req[i / 8] << (i % 8)) & 0x80) ? 0xFF : 0x00;
+
+    //Send bytes one by one with an idle gap, so the PIC is ready for every falling edge
+    for(int i=0; i<(int)sizeof(bits); i++) {
+        if(write(fd, &bits[i], 1) != 1) return -1;
+        tcdrain(fd);
+        usleep(RX_GAP_US);
+    }
+    return 0;
+}
+
+static int openSerial(const char *path) {
+    int fd = open(path, O_RDWR | O_NOCTTY);
+    if(fd < 0) return -1;
+
+    struct termios tio;
+    if(tcgetattr(fd, &tio) == 0) {
+        cfmakeraw(&tio);
+        cfsetispeed(&tio, B1000000);
+        cfsetospeed(&tio, B1000000);
+        tio.c_cflag |= CLOCAL | CREAD;
+        tio.c_cflag &= ~PARENB;
+        tio.c_cflag |= CSTOPB;
+        tcsetattr(fd, TCSANOW, &tio);
+    }
+    return fd;
+}
+
+int main(int argc, char **argv) {
+    if(argc < 5) {
+        fprintf(stderr, "Usage: %s <serial device> <output image> <first sector> <sector count>\n", argv[0]);
+        return 1;
+    }
+    uint32_t next = (uint32_t)strtoul(argv[3], NULL, 0);
+    uint32_t last = next + (uint32_t)strtoul(argv[4], NULL, 0);
+    if((next > MAX_SECTOR) || (last < next) || (last > (MAX_SECTOR + 1))) {
+        fprintf(stderr, "Range past the last addressable sector (0x%lX)\n", MAX_SECTOR);
+        return 1;
+    }
+
+    int fd = openSerial(argv[1]);
+    FILE *out = fopen(argv[2], "r+b");
+    if(!out) out = fopen(argv[2], "w+b");
+    if((fd < 0) || !out) {
+        perror("open");
+        return 1;
+    }
+
+    int retries = 0;
+    uint8_t frame[1 + 4 + BLOCK_SIZE + 2];
+    while(next < last) {
+        uint32_t left = last - next;
+        uint16_t count = (uint16_t)((left > MAX_COUNT) ? MAX_COUNT : left);
+        uint32_t end = next + count;
+        sendRequest(fd, next, count);
+
+        //Receive frames until end marker, a bad frame or a timeout
+        int ok = 1;
+        int ended = 0;
+        while(1) {
+            if(readFull(fd, frame, 5, TIMEOUT_MS) != 0) {
+                ok = 0;
+                break;
+            }
+            if(frame[0] != SYNC) {
+                ok = 0;
+                break;
+            }
+            uint32_t sector = be32(frame + 1);
+            if(sector == END_SECTOR) {
+                ended = 1;
+                //End marker before the last requested sector: the PIC could not read the range
+                if(next < end) {
+                    fprintf(stderr, "Sector %u: transfer ended early\n", next);
+                    ok = 0;
+                }
+                break;
+            }
+            if((sector != next) || (readFull(fd, frame + 5, BLOCK_SIZE + 2, TIMEOUT_MS) != 0)) {
+                ok = 0;
+                break;
+            }
+            uint8_t *data = frame + 5;
+            if(crc16(data, BLOCK_SIZE) != (uint16_t)((data[BLOCK_SIZE] << 8) | data[BLOCK_SIZE + 1])) {
+                fprintf(stderr, "Sector %u: CRC error\n", sector);
+                ok = 0;
+                break;
+            }
+            fseek(out, (long)sector * BLOCK_SIZE, SEEK_SET);
+            fwrite(data, 1, BLOCK_SIZE, out);
+            next++;
+            retries = 0;
+        }
+
+        //On error, abort the transfer if still running, drop what is left of it and resume from the first missing sector
+        if(!ok) {
+            uint8_t drain[BLOCK_SIZE];
+            if(!ended) {
+                uint8_t abort = ABORT;
+                if(write(fd, &abort, 1) == 1) tcdrain(fd);
+            }
+            while(readFull(fd, drain, 1, DRAIN_MS) == 0);
+            if(++retries > MAX_RETRIES) {
+                fprintf(stderr, "Giving up at sector %u\n", next);
+                break;
+            }
+            fprintf(stderr, "Resuming from sector %u\n", next);
+        }
+    }
+
+    fclose(out);
+    close(fd);
+    return (next >= last) ? 0 : 1;
+}
\ No newline at end of file
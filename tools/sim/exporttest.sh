@@ -0,0 +1,35 @@
+#!/bin/sh
+#
+# 20261019.001
+# SD Card
+#
+# File: exporttest.sh
+# Export of a sector range: Export.c on the simulated card behind a pty, received by tools/export.
+# The simulator flips a bit every 200000 bytes sent, so the receiver has to abort and resume
+# Author: wizlab.it
+#
+# Usage (from the repository root): sh tools/sim/exporttest.sh [work directory]
+#
+
+set -e
+DIR=${1:-/tmp}
+FIRST=4096
+COUNT=2048
+
+cc -fcommon -D_SD_RA5_CS -I tools/sim -I . -o "$DIR/sdsim" tools/sim/sdsim.c SD.c Scrub.c Store.c Pack.c Export.c
+cc -o "$DIR/export" tools/export.c
+rm -f "$DIR/export.tty" "$DIR/export.out"
+"$DIR/sdsim" -e "$DIR/export" > "$DIR/export.log" &
+SIM=$!
+while [ ! -e "$DIR/export.tty" ]; do sleep 1; done
+
+if "$DIR/export" "$DIR/export.tty" "$DIR/export.out" 0x7FFFFF 2 2> /dev/null; then
+    echo "export: range past the last sector accepted"
+    kill $SIM
+    exit 1
+fi
+"$DIR/export" "$DIR/export.tty" "$DIR/export.out" $FIRST $COUNT 2>&1 | grep -c 'Resuming' | sed 's/^/export: resumed /'
+wait $SIM
+grep '^export:' "$DIR/export.log" | tail -1
+cmp -i $((FIRST * 512)) -n $((COUNT * 512)) "$DIR/export.ref" "$DIR/export.out"
+echo "export: round trip OK"
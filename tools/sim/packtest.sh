@@ -0,0 +1,21 @@
+#!/bin/sh
+#
+# 20261019.001
+# SD Card
+#
+# File: packtest.sh
+# Round trip of packed samples: Pack.c on the simulated card, then tools/unpack
+# Author: wizlab.it
+#
+# Usage (from the repository root): sh tools/sim/packtest.sh [work directory]
+#
+
+set -e
+DIR=${1:-/tmp}
+
+cc -fcommon -D_SD_RA5_CS -I tools/sim -I . -o "$DIR/sdsim" tools/sim/sdsim.c SD.c Scrub.c Store.c Pack.c Export.c
+cc -o "$DIR/unpack" tools/unpack.c
+"$DIR/sdsim" -p "$DIR/pack" | grep '^pack:'
+"$DIR/unpack" "$DIR/pack.img" "$DIR/pack.out"
+cmp "$DIR/pack.raw" "$DIR/pack.out"
+echo "pack: round trip OK"
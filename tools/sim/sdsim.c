@@ -0,0 +1,916 @@
+/*
+ * 20261019.001
+ * SD Card
+ *
+ * File: sdsim.c
+ * Host simulator of the SPI bus and of an SD card, running the driver code
+ * Author: wizlab.it
+ *
+ * Build: cc -fcommon -D_SD_RA5_CS -I tools/sim -I . -o sdsim tools/sim/sdsim.c SD.c Scrub.c Store.c Pack.c Export.c
+ * Usage: sdsim [-n] [-a access time] [-b stop busy] [-w write busy] [-u AU copy time] [-p file prefix] [-e file prefix]
+ *  -n  card without predefined-count reads (CMD23)
+ *  -a  card read access time before each data block, in us (default 0)
+ *  -b  card busy after CMD12 stops a read, in us (default 0)
+ *  -w  card programming time after each written block, in us (default 250)
+ *  -u  card time to copy a sector when a write lands inside an AU out of sequence, in us (default 20),
+ *      modeled in the AU alignment benchmark only
+ *  -p  save the packed sectors to <prefix>.img and the samples packed to <prefix>.raw, for tools/unpack
+ *      (see packtest.sh)
+ *  -e  export mode: serve the card on RA5 with Export.c on the pty <prefix>.tty, for tools/export, until
+ *      the host closes it. The card image is saved to <prefix>.ref first (see exporttest.sh)
+ * Runs card init, short multi block reads, single block writes, a scrub with injected CRC errors and
+ * a data error token, striping over a second card on RA5, packed sample writes, export ranges at the end
+ * of the address space, and timestamp queries on record stores, then prints the
+ * simulated bus time. Stores of the whole 4GB card have their data blocks synthesized.
+ * Time is counted for SPI transfers (8 bits at the configured clock) and
+ * delays only: CPU time is not modeled, so rates on target are lower.
+ * In export mode the simulated time also runs while waiting for the host, at real speed.
+ */
+
+#define _GNU_SOURCE                     //posix_openpt, usleep
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/select.h>
+#include "Scrub.h"
+#include "Store.h"
+#include "Pack.h"
+#include "Export.h"
+
+#define CARD_SECTORS        0x800000    //4GB
+#define IMAGE_SECTORS       32768       //First 16MB kept in memory, the rest is synthesized, see blockData
+#define TMR0_PERIOD_US      8192        //FOSC / 4 / 256 / 256
+#define QUEUE_SIZE          600
+#define AU_SECTORS          8192        //4MB, as reported in SD Status
+#define PACK_SAMPLES        200000
+#define TX_BYTE_US          10          //1Mbaud: start bit, 8 data bits, stop bit
+#define RX_BYTE_US          11          //Bytes from the host have 2 stop bits
+#define RX_QUEUE_SIZE       64
+#define TX_FLIP_EVERY       200000      //One bit flipped in every that many bytes sent, as line noise
+
+enum { S_IDLE, S_READ, S_WRITE_WAIT, S_WRITE_DATA };
+enum { P_STEP, P_SKEW };
+
+SIM_TRISA TRISAbits;
+SIM_APFCON APFCONbits;
+SIM_SSP1CON1 SSP1CON1bits;
+SIM_TXSTA TXSTAbits;
+SIM_RCSTA RCSTAbits;
+SIM_BAUDCON BAUDCONbits;
+SIM_IOCAN IOCANbits;
+volatile uint8_t SSP1BUF, LATA, TRISA, SPBRGL, SPBRGH;
+volatile uint16_t TXREG = 0x100;
+
+typedef struct {
+    uint8_t *image;
+    uint64_t busyUntil;                 //Card holds DO low until then
+    uint64_t readyAt;                   //Next read block available from then
+    uint8_t q[QUEUE_SIZE];              //Bytes the card is going to send
+    uint16_t qLen, qPos;
+    uint8_t cmd[6], cmdLen, isApp, isIdle, initTries, state, isMulti;
+    uint32_t sector, readLeft, preset;
+    uint8_t data[514];
+    uint16_t dataLen;
+    uint16_t auNext[CARD_SECTORS / AU_SECTORS];   //Offset in each AU of the next sequential write
+} SIM_CARD;
+
+static SIM_CARD cards[2];               //CS on RA4 and on RA5
+static SIM_CARD *card;                  //Card being clocked
+static uint32_t busConflicts;           //Bytes clocked with both cards selected
+static SD_CARD card1;                   //Driver side of the second card
+static uint64_t now;                    //Simulated time (us)
+static uint32_t accessUs = 0;
+static uint32_t stopBusyUs = 0;
+static uint32_t writeBusyUs = 250;
+static uint8_t hasCmd23 = 1;
+static uint32_t auCopyUs = 20;
+static uint8_t auModel;
+static const char *packPrefix;
+static uint32_t cmdCount[64];
+static uint32_t blocksRead;
+
+static const char *exportPrefix;
+static int pty = -1;                    //Master side, the host opens <prefix>.tty
+static uint8_t isHostOpen;
+static uint8_t rxQ[RX_QUEUE_SIZE];      //Bytes of the host on RA3, each from rxAt on
+static uint64_t rxAt[RX_QUEUE_SIZE];
+static uint8_t rxHead, rxLen;
+static uint64_t rxFree;                 //RA3 free for the next byte of the host from then
+static uint8_t txBuf[4096];             //Bytes sent, not written to the pty yet
+static uint16_t txLen;
+static uint64_t txEnd;                  //Last byte sent is on the line until then
+static uint64_t txBytes, rxBytes;
+static uint32_t txFlips;
+static uint64_t exportStart;
+static SIM_IOCAF iocaf;
+
+static uint8_t profile;                 //Timestamps of store records, see recordTs
+static uint32_t repeat, records;
+static uint32_t synthData;              //First data sector of the synthesized store, 0 if none
+
+static uint32_t crcBad[] = { 100, 101, 2000 };
+static uint32_t tokenBad[] = { 3000 };
+static uint32_t writeBad[] = { 4000 };
+
+static uint8_t byteUs(void) {
+    //8 bits at FOSC / 4, FOSC / 16, FOSC / 64
+    static const uint8_t us[4] = { 1, 4, 16, 16 };
+    return us[SSP1CON1bits.SSPM & 0x03];
+}
+
+static void put(uint8_t c) {
+    if(card->qPos == card->qLen) card->qLen = card->qPos = 0;
+    if(card->qLen < QUEUE_SIZE) card->q[card->qLen++] = c;
+}
+
+static uint16_t crc16(const uint8_t *p, uint16_t len) {
+    uint16_t crc = 0;
+    while(len--) crc = SD_Card_Crc16Byte(crc, *p++);
+    return crc;
+}
+
+static uint8_t listed(const uint32_t *list, uint8_t n, uint32_t s) {
+    for(uint8_t i=0; i<n; i++) if(list[i] == s) return 1;
+    return 0;
+}
+
+static void putData(const uint8_t *p, uint16_t len, uint16_t crc) {
+    put(0xFE);
+    for(uint16_t i=0; i<len; i++) put(p[i]);
+    put((uint8_t)(crc >> 8));
+    put((uint8_t)crc);
+}
+
+static uint32_t recordTs(uint32_t r) {
+    //Step: one timestamp every 10, on repeat consecutive records. Skewed: first half of the records 3 every 2, then one every 14
+    if(profile == P_STEP) return 1000 + ((r / repeat) * 10);
+    uint32_t h = records / 2;
+    return (r < h) ? (1000 + ((r * 2) / 3)) : (1000 + ((h * 2) / 3) + ((r - h) * 14));
+}
+
+static void makeRecord(uint8_t *rec, uint32_t r) {
+    //Timestamp, record number, filler
+    uint32_t ts = recordTs(r);
+    memset(rec, (uint8_t)r, _SD_STORE_RECORD_SIZE);
+    memcpy(rec, &ts, 4);
+    memcpy(rec + 4, &r, 4);
+}
+
+static const uint8_t *blockData(uint32_t s) {
+    //Past the image, data blocks of the synthesized store are generated on the fly
+    static uint8_t synth[512];
+    if(s < IMAGE_SECTORS) return card->image + (s * 512);
+    memset(synth, 0, sizeof(synth));
+    if((synthData != 0) && (s >= synthData) && (((s - synthData) * (uint64_t)_SD_STORE_RECORDS_PER_BLOCK) < records)) {
+        for(uint8_t k=0; k<_SD_STORE_RECORDS_PER_BLOCK; k++) {
+            makeRecord(synth + (k * _SD_STORE_RECORD_SIZE), ((s - synthData) * _SD_STORE_RECORDS_PER_BLOCK) + k);
+        }
+    }
+    return synth;
+}
+
+static void putBlock(void) {
+    //Data error token: the card stops sending, the host has to end the read
+    if((card->sector >= CARD_SECTORS) || listed(tokenBad, sizeof(tokenBad) / 4, card->sector)) {
+        put((card->sector >= CARD_SECTORS) ? 0x08 : 0x04);
+        card->readLeft = 0;
+        return;
+    }
+    const uint8_t *p = blockData(card->sector);
+    uint16_t crc = crc16(p, 512);
+    if(listed(crcBad, sizeof(crcBad) / 4, card->sector)) crc ^= 0x0001;
+    putData(p, 512, crc);
+    blocksRead++;
+    card->sector++;
+    card->readLeft--;
+    card->readyAt = now + ((uint64_t)(card->qLen - card->qPos) * byteUs()) + accessUs;
+}
+
+static uint32_t auCopy(uint32_t s) {
+    //An AU is written at full speed from its first sector on. A write anywhere else makes the card copy the sectors before it
+    if(!auModel) return 0;
+    uint32_t cost = ((s % AU_SECTORS) != card->auNext[s / AU_SECTORS]) ? ((s % AU_SECTORS) * auCopyUs) : 0;
+    card->auNext[s / AU_SECTORS] = (uint16_t)((s + 1) % AU_SECTORS);
+    return cost;
+}
+
+static void command(void) {
+    uint8_t c = card->cmd[0] & 0x3F;
+    uint32_t arg = ((uint32_t)card->cmd[1] << 24) | ((uint32_t)card->cmd[2] << 16) | ((uint32_t)card->cmd[3] << 8) | card->cmd[4];
+    static const uint8_t cid[16] = { 0x03, 'S', 'D', 'S', 'I', 'M', '0', '1', 0x10, 0, 0, 0, 1, 0x01, 0x4A, 0x01 };
+    static const uint8_t csd[16] = { 0x40, 0x0E, 0x00, 0x32, 0x5B, 0x59, 0x00, 0x00, 0x1F, 0xFF, 0x7F, 0x80, 0x0A, 0x40, 0x00, 0x01 };
+    uint8_t scr[8] = { 0x02, 0x35, 0x80, 0x01, 0, 0, 0, 0 };
+    uint8_t ssr[64] = { 0 };
+
+    cmdCount[c]++;
+    card->qLen = card->qPos = 0;
+    card->state = S_IDLE;
+    put(0xFF);                          //Response delay (NCR)
+
+    if(card->isApp) {
+        card->isApp = 0;
+        switch(c) {
+            case 41:
+                if(card->initTries != 0) card->initTries--;
+                if(card->initTries == 0) card->isIdle = 0;
+                put(card->isIdle);
+                return;
+            case 51:
+                if(hasCmd23) scr[3] |= 0x02;
+                put(0x00);
+                putData(scr, 8, crc16(scr, 8));
+                return;
+            case 13:
+                ssr[8] = 0x02;          //Speed class 4
+                ssr[10] = 0x90;         //AU 4MB
+                ssr[12] = 0x10;         //Erase 16 AU
+                ssr[13] = 0x28;         //in 10s
+                put(0x00);
+                put(0x00);
+                putData(ssr, 64, crc16(ssr, 64));
+                return;
+        }
+    }
+
+    switch(c) {
+        case 0:
+            card->isIdle = 1;
+            card->initTries = 3;
+            put(0x01);
+            break;
+        case 55:
+            card->isApp = 1;
+            put(card->isIdle);
+            break;
+        case 9:
+            put(0x00);
+            putData(csd, 16, crc16(csd, 16));
+            break;
+        case 10:
+            put(0x00);
+            putData(cid, 16, crc16(cid, 16));
+            break;
+        case 12:
+            put(0x00);
+            card->busyUntil = now + stopBusyUs;
+            break;
+        case 16:
+            put(0x00);
+            break;
+        case 13:
+            put(0x00);
+            put(0x00);
+            break;
+        case 17:
+        case 18:
+            put(0x00);
+            card->state = S_READ;
+            card->sector = arg / 512;
+            card->readLeft = (c == 17) ? 1 : ((card->preset != 0) ? card->preset : 0xFFFFFFFF);
+            card->readyAt = now + ((uint64_t)(card->qLen - card->qPos) * byteUs()) + accessUs;
+            card->preset = 0;
+            break;
+        case 23:
+            put(hasCmd23 ? 0x00 : 0x04);
+            if(hasCmd23) card->preset = arg;
+            break;
+        case 24:
+        case 25:
+            put(0x00);
+            card->state = S_WRITE_WAIT;
+            card->isMulti = (c == 25);
+            card->sector = arg / 512;
+            card->preset = 0;
+            break;
+        default:
+            put(0x04);                  //Illegal command
+            break;
+    }
+}
+
+static void receive(uint8_t c) {
+    if(card->state == S_WRITE_DATA) {
+        card->data[card->dataLen++] = c;
+        if(card->dataLen == 514) {
+            if(listed(writeBad, sizeof(writeBad) / 4, card->sector)) {
+                put(0xED);              //Write error
+            } else {
+                if(card->sector < IMAGE_SECTORS) memcpy(card->image + (card->sector * 512), card->data, 512);
+                put(0xE5);              //Data accepted
+            }
+            card->busyUntil = now + writeBusyUs + auCopy(card->sector);
+            card->sector++;
+            card->state = card->isMulti ? S_WRITE_WAIT : S_IDLE;
+        }
+        return;
+    }
+    if(card->state == S_WRITE_WAIT) {
+        if(c == (card->isMulti ? 0xFC : 0xFE)) {
+            card->state = S_WRITE_DATA;
+            card->dataLen = 0;
+            return;
+        }
+        if(card->isMulti && (c == 0xFD)) {
+            card->state = S_IDLE;
+            card->busyUntil = now + writeBusyUs;
+        }
+        return;                         //Commands are not accepted while a write is open
+    }
+
+    //Command: 01xxxxxx, then 4 argument bytes and CRC
+    if((card->cmdLen == 0) && ((c & 0xC0) != 0x40)) return;
+    card->cmd[card->cmdLen++] = c;
+    if(card->cmdLen == 6) {
+        card->cmdLen = 0;
+        command();
+    }
+}
+
+static uint8_t exchange(uint8_t mosi) {
+    now += byteUs();
+    if((LATA & (_SD_SPI_CS_RA4 | _SD_SPI_CS_RA5)) == 0) busConflicts++;
+    if((LATA & _SD_SPI_CS_RA4) == 0) {
+        card = &cards[0];
+    } else if((LATA & _SD_SPI_CS_RA5) == 0) {
+        card = &cards[1];
+    } else {
+        return 0xFF;
+    }
+
+    uint8_t miso = 0xFF;
+    if((card->qPos == card->qLen) && (card->state == S_READ) && (card->readLeft != 0) && (now >= card->readyAt)) {
+        card->qLen = card->qPos = 0;
+        putBlock();
+    }
+    if(card->qPos < card->qLen) {
+        miso = card->q[card->qPos++];
+    } else if(now < card->busyUntil) {
+        miso = 0x00;
+    }
+    receive(mosi);
+    return miso;
+}
+
+static void txLoad(void);
+
+SIM_SSP1STAT *sim_SSP1STAT(void) {
+    static SIM_SSP1STAT stat;
+    txLoad();
+    SSP1BUF = exchange(SSP1BUF);
+    stat.BF = 1;
+    return &stat;
+}
+
+volatile uint8_t *sim_TMR0IF(void) {
+    static volatile uint8_t flag;
+    static uint64_t overflows;
+    if((now / TMR0_PERIOD_US) != overflows) {
+        overflows = now / TMR0_PERIOD_US;
+        flag = 1;
+    }
+    return &flag;
+}
+
+void sim_Delay(uint32_t us) {
+    now += us;
+}
+
+static void exportDone(void) {
+    //Host has closed the pty
+    double s = (double)(now - exportStart) / 1e6;
+    printf("export: %llu bytes sent in %.2fs (%.1f KB/s), %u bits flipped, %u blocks read, %llu bytes received\n",
+        (unsigned long long)txBytes, s, (double)txBytes / 1024 / s, txFlips, blocksRead, (unsigned long long)rxBytes);
+    exit(0);
+}
+
+static uint8_t ptyRead(uint32_t waitUs) {
+    //Queue the bytes of the host on RA3, back to back from now. Simulated time runs while waiting
+    struct timespec t0, t1;
+    fd_set set;
+    struct timeval tv = { waitUs / 1000000, waitUs % 1000000 };
+    uint8_t buf[RX_QUEUE_SIZE];
+    if(rxLen == RX_QUEUE_SIZE) return 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    FD_ZERO(&set);
+    FD_SET(pty, &set);
+    ssize_t n = (select(pty + 1, &set, NULL, NULL, &tv) > 0) ? read(pty, buf, RX_QUEUE_SIZE - rxLen) : 0;
+    if(n < 0) {
+        //EIO: the host has not opened the pty yet, or has closed it
+        if(isHostOpen) exportDone();
+        usleep(waitUs);
+        n = 0;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    if(waitUs != 0) now += (uint64_t)(((t1.tv_sec - t0.tv_sec) * 1000000) + ((t1.tv_nsec - t0.tv_nsec) / 1000));
+
+    for(ssize_t i=0; i<n; i++) {
+        uint8_t q = (uint8_t)((rxHead + rxLen++) % RX_QUEUE_SIZE);
+        if(rxFree < now) rxFree = now;
+        rxQ[q] = buf[i];
+        rxAt[q] = rxFree;
+        rxFree += RX_BYTE_US;
+        if(IOCANbits.IOCAN3) iocaf.IOCAF3 = 1;
+    }
+    if((n > 0) && !isHostOpen) {
+        isHostOpen = 1;
+        exportStart = now;
+    }
+    rxBytes += (uint64_t)n;
+    return (n > 0);
+}
+
+static void ptyFlush(void) {
+    //Write the bytes sent, taking the ones of the host meanwhile so neither side blocks
+    uint16_t pos = 0;
+    while(pos < txLen) {
+        fd_set rd, wr;
+        FD_ZERO(&rd);
+        FD_ZERO(&wr);
+        FD_SET(pty, &rd);
+        FD_SET(pty, &wr);
+        if(select(pty + 1, &rd, &wr, NULL, NULL) <= 0) continue;
+        if(FD_ISSET(pty, &rd)) ptyRead(0);
+        if(FD_ISSET(pty, &wr)) {
+            ssize_t n = write(pty, txBuf + pos, txLen - pos);
+            if(n > 0) {
+                pos += (uint16_t)n;
+            } else if((errno != EAGAIN) && (errno != EINTR)) {
+                exportDone();
+            }
+        }
+    }
+    txLen = 0;
+}
+
+static void txLoad(void) {
+    //Put a byte written to TXREG on the line, right after the previous one
+    if(TXREG == 0x100) return;
+    uint8_t c = (uint8_t)TXREG;
+    TXREG = 0x100;
+    if((++txBytes % TX_FLIP_EVERY) == 0) {
+        c ^= 0x01;
+        txFlips++;
+    }
+    txEnd = ((txEnd > now) ? txEnd : now) + TX_BYTE_US;
+    if(txLen < sizeof(txBuf)) txBuf[txLen++] = c;
+    if((txLen == sizeof(txBuf)) && (pty >= 0)) ptyFlush();
+}
+
+static uint8_t rxLine(void) {
+    //RA3 level: start bit, 8 data bits LSB first, then idle
+    while((rxLen != 0) && (now >= (rxAt[rxHead] + RX_BYTE_US))) {
+        rxHead = (uint8_t)((rxHead + 1) % RX_QUEUE_SIZE);
+        rxLen--;
+    }
+    if((rxLen == 0) || (now < rxAt[rxHead])) return 1;
+    uint64_t bit = now - rxAt[rxHead];
+    if(bit == 0) return 0;
+    return (bit <= 8) ? ((rxQ[rxHead] >> (bit - 1)) & 1) : 1;
+}
+
+SIM_PORTA *sim_PORTA(void) {
+    //Every poll of the pin takes 1us. With nothing from the host, send what is pending and wait for it
+    static SIM_PORTA port;
+    txLoad();
+    now++;
+    port.RA3 = rxLine();
+    if(port.RA3 && (rxLen == 0) && (pty >= 0)) {
+        ptyFlush();
+        ptyRead(1000);
+        port.RA3 = rxLine();
+    }
+    return &port;
+}
+
+SIM_PIR1 *sim_PIR1(void) {
+    //Transmit buffer is free when the last byte starts: a poll loop waits until then
+    static SIM_PIR1 pir;
+    txLoad();
+    if((now + TX_BYTE_US) < txEnd) now = txEnd - TX_BYTE_US;
+    pir.TXIF = 1;
+    return &pir;
+}
+
+SIM_IOCAF *sim_IOCAF(void) {
+    if(pty >= 0) ptyRead(0);
+    return &iocaf;
+}
+
+static uint32_t rnd(void) {
+    static uint32_t seed = 12345;
+    seed = (seed * 1103515245) + 12345;
+    return seed >> 8;
+}
+
+static void scrub(void) {
+    uint32_t calls = 0;
+    for(uint32_t i=0; i<(4096 * 512); i++) cards[0].image[i] = (uint8_t)rnd();
+
+    uint64_t start = now;
+    SD_Scrub_Init(0, 4096);
+    while(SD_Scrub_Run(12)) calls++;
+    double s = (double)(now - start) / 1e6;
+
+    printf("scrub: 4096 sectors in %.2fs, %.1f sectors/s (%.1f KB/s), SD_Scrub_Rate %lu, %lu calls\n",
+        s, 4096 / s, 2048 / s, (unsigned long)SD_Scrub_Rate(), (unsigned long)calls + 1);
+    for(uint8_t i=0; i<SD_SCRUB.badCount; i++) {
+        printf("scrub: bad %lu+%u\n", (unsigned long)SD_SCRUB.bad[i].start, SD_SCRUB.bad[i].count);
+    }
+    printf("scrub: range ending past sector 0x7FFFFF %s\n", (SD_Scrub_Init(_SD_MAX_SECTOR, 2) == _SD_ERR_FLAG) ? "rejected" : "accepted");
+}
+
+static void transfers(void) {
+    //Short multi block reads: bus time per transfer beyond the data bytes of its blocks
+    uint8_t hasCount = SD_FLAGS.cardBlockCountOK;
+    for(uint8_t mode=0; mode<2; mode++) {
+        SD_FLAGS.cardBlockCountOK = (mode == 0) ? hasCount : 0;
+        for(uint8_t n=2; n<=8; n<<=1) {
+            uint64_t start = now;
+            for(uint8_t k=0; k<64; k++) {
+                if(!SD_Card_ReadInitCount((uint32_t)k * 8 * 512, n)) break;
+                for(uint8_t b=0; b<n; b++) {
+                    SD_Card_RWStartMulti();
+                    for(uint16_t i=0; i<512; i++) SD_SPI_Read();
+                    SD_Card_RWStopMulti();
+                }
+                SD_Card_RWEnd();
+            }
+            double us = (double)(now - start) / 64;
+            printf("read: %u blocks, stop by %s, %.0fus per transfer, %.0fus overhead\n", n,
+                SD_FLAGS.cardBlockCountOK ? "CMD23" : "CMD12", us, us - (n * 512.0 * byteUs()));
+        }
+    }
+    SD_FLAGS.cardBlockCountOK = hasCount;
+}
+
+static void writeBehind(void) {
+    //64 single block writes. With write-behind the application works in 100us steps while SD_Card_Poll() reports busy
+    uint8_t block[512];
+    memset(block, 0x5A, sizeof(block));
+    for(uint8_t mode=0; mode<2; mode++) {
+        uint64_t start = now;
+        uint64_t work = 0;
+        uint8_t failed = 0;
+        SD_Card_SetWriteBehind(mode);
+        for(uint32_t k=0; k<64; k++) {
+            if(SD_Card_WriteBlock((4096 + k) * 512, block) != _SD_OK_FLAG) failed++;
+            while(mode && SD_Card_Poll()) {
+                now += 100;
+                work += 100;
+            }
+        }
+        uint8_t rejected = (SD_Card_WriteBlock(4000UL * 512, block) == _SD_ERR_FLAG);
+        SD_Card_SetWriteBehind(0);
+        printf("write: write-behind %s, %.0fus in driver and %.0fus of work per block, %.0f%% of programming time recovered, %u failed, bad block %s\n",
+            mode ? "on" : "off", (double)(now - start - work) / 64, (double)work / 64, (100.0 * work) / (64.0 * writeBusyUs), failed, rejected ? "rejected" : "accepted");
+    }
+}
+
+static void stripe(void) {
+    //256 blocks to one card with write-behind, then to two cards in turn, as card programming time grows
+    static const uint32_t busy[4] = { 250, 5000, 10000, 20000 };
+    uint8_t block[512];
+    uint32_t saved = writeBusyUs;
+    uint16_t misplaced = 0;
+
+    SD_Card_Select(&card1);
+    SD_Card_Init();
+    uint8_t isActive = SD_Card_IsActive();
+    SD_Card_Select(&SD_CARD0);
+    if(!isActive) {
+        printf("stripe: second card init failed\n");
+        return;
+    }
+    for(uint8_t k=0; k<4; k++) {
+        double kbs[2];
+        writeBusyUs = busy[k];
+        for(uint8_t mode=0; mode<2; mode++) {
+            uint64_t start = now;
+            if(mode == 0) {
+                SD_Card_SetWriteBehind(1);
+                if(SD_Card_RWInit(5000UL * 512, _SD_WRITE_FLAG, _SD_BLOCK_MULTI_FLAG)) {
+                    for(uint16_t b=0; b<256; b++) {
+                        if(!SD_Card_RWStartMulti()) break;
+                        memset(block, (uint8_t)b, sizeof(block));
+                        for(uint16_t i=0; i<512; i++) SD_SPI_Write(block[i]);
+                        SD_Card_RWStopMulti();
+                    }
+                    SD_Card_RWEnd();
+                }
+                SD_Card_SetWriteBehind(0);
+            } else if(SD_Stripe_Init(&SD_CARD0, &card1, 5000UL * 512)) {
+                for(uint16_t b=0; b<256; b++) {
+                    if(!SD_Stripe_StartBlock()) break;
+                    memset(block, (uint8_t)b, sizeof(block));
+                    for(uint16_t i=0; i<512; i++) SD_SPI_Write(block[i]);
+                    SD_Stripe_StopBlock();
+                }
+                SD_Stripe_End();
+            }
+            kbs[mode] = 128 / ((double)(now - start) / 1e6);
+        }
+        printf("stripe: %5luus programming, one card %.1f KB/s, two cards %.1f KB/s\n", (unsigned long)busy[k], kbs[0], kbs[1]);
+    }
+    writeBusyUs = saved;
+
+    //Even blocks on the first card, odd blocks on the second one, at the same sectors
+    for(uint16_t b=0; b<256; b++) {
+        if(cards[b & 1].image[(5000UL + (b >> 1)) * 512] != (uint8_t)b) misplaced++;
+    }
+    printf("stripe: %u blocks misplaced, %lu bytes clocked with both cards selected\n", misplaced, (unsigned long)busConflicts);
+}
+
+static void pack(void) {
+    //8 bit samples changing slowly: a level held for 1 to 64 samples, then a step of -2 to +2. One stretch in 8 is noise
+    static uint8_t samples[PACK_SAMPLES];
+    uint8_t level = 128;
+    for(uint32_t i=0; i<PACK_SAMPLES; ) {
+        uint32_t r = rnd();
+        uint8_t isNoise = ((r >> 8) & 0x07) == 0;
+        for(uint8_t n=1 + (r % 64); (n != 0) && (i < PACK_SAMPLES); n--) {
+            samples[i++] = isNoise ? (uint8_t)rnd() : level;
+        }
+        level += (uint8_t)(((r >> 12) % 5) - 2);
+    }
+
+    //Raw: samples straight to a multi block write session
+    uint64_t start = now;
+    if(SD_Card_RWInit(5000UL * 512, _SD_WRITE_FLAG, _SD_BLOCK_MULTI_FLAG)) {
+        for(uint32_t i=0; i<PACK_SAMPLES; i+=512) {
+            if(!SD_Card_RWStartMulti()) break;
+            for(uint16_t j=0; j<512; j++) SD_SPI_Write(((i + j) < PACK_SAMPLES) ? samples[i + j] : 0xFF);
+            SD_Card_RWStopMulti();
+        }
+        SD_Card_RWEnd();
+    }
+    double raw = (double)(now - start) / 1e6;
+
+    //Packed, from the next AU boundary
+    start = now;
+    if(!SD_Pack_Begin(5000UL * 512)) {
+        printf("pack: begin failed\n");
+        return;
+    }
+    uint32_t first = SD_CURRENT->addr / 512;
+    uint8_t failed = 0;
+    for(uint32_t i=0; i<PACK_SAMPLES; i++) {
+        if(SD_Pack_Put(samples[i]) != _SD_OK_FLAG) {
+            failed = 1;
+            break;
+        }
+    }
+    if(SD_Pack_End() != _SD_OK_FLAG) failed = 1;
+    double packed = (double)(now - start) / 1e6;
+    uint32_t count = (SD_CURRENT->addr / 512) - first;
+
+    printf("pack: %u samples in %lu sectors, ratio %.2f, %s\n", PACK_SAMPLES, (unsigned long)count, PACK_SAMPLES / (count * 512.0), failed ? "failed" : "written");
+    printf("pack: raw writes %.0f samples/s, packed writes %.0f samples/s\n", PACK_SAMPLES / raw, PACK_SAMPLES / packed);
+
+    //Sectors and samples for the round trip through tools/unpack
+    if(packPrefix != NULL) {
+        char name[256];
+        snprintf(name, sizeof(name), "%s.img", packPrefix);
+        FILE *f = fopen(name, "wb");
+        if(f != NULL) {
+            fwrite(cards[0].image + (first * 512), 512, count, f);
+            fclose(f);
+        }
+        snprintf(name, sizeof(name), "%s.raw", packPrefix);
+        f = fopen(name, "wb");
+        if(f != NULL) {
+            fwrite(samples, 1, PACK_SAMPLES, f);
+            fclose(f);
+        }
+    }
+}
+
+static void exportRange(void) {
+    //Ranges ending at the last addressable sector are sent, ranges past it only get the end mark
+    static const uint32_t first[3] = { _SD_MAX_SECTOR - 1, _SD_MAX_SECTOR, 0xFFFFFFFF };
+    for(uint8_t k=0; k<3; k++) {
+        uint32_t blocks = blocksRead;
+        txLen = 0;
+        SD_Export_Send(first[k], 2);
+        txLoad();
+        printf("export: 2 sectors from 0x%08lX, %u bytes sent, %lu blocks read\n", (unsigned long)first[k], txLen, (unsigned long)(blocksRead - blocks));
+    }
+    txLen = 0;
+}
+
+static int cmpUs(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+static void auWrites(void) {
+    //Logger sessions of 64 blocks at random places, started as given or on the next AU boundary.
+    //Latency of a block: from its start to its end, waiting for the card included
+    static uint32_t lat[32 * 64];
+    uint8_t block[512];
+    memset(block, 0xA5, sizeof(block));
+    auModel = 1;
+    for(uint8_t mode=0; mode<2; mode++) {
+        uint16_t n = 0;
+        uint64_t start = now;
+        memset(cards[0].auNext, 0, sizeof(cards[0].auNext));
+        for(uint8_t k=0; k<32; k++) {
+            uint32_t addr = (rnd() % (IMAGE_SECTORS - (2 * AU_SECTORS))) * 512;
+            if(mode == 1) addr = SD_Card_AUAlign(addr);
+            if(!SD_Card_RWInit(addr, _SD_WRITE_FLAG, _SD_BLOCK_MULTI_FLAG)) break;
+            for(uint8_t b=0; b<64; b++) {
+                uint64_t t = now;
+                if(!SD_Card_RWStartMulti()) break;
+                for(uint16_t i=0; i<512; i++) SD_SPI_Write(block[i]);
+                SD_Card_RWStopMulti();
+                if(b == 63) SD_Card_RWEnd();
+                lat[n++] = (uint32_t)(now - t);
+            }
+        }
+        double s = (double)(now - start) / 1e6;
+        qsort(lat, n, sizeof(lat[0]), cmpUs);
+        printf("write: AU %s sessions, block latency p50 %.1fms, p99 %.1fms, max %.1fms, %.1f KB/s\n", mode ? "aligned" : "unaligned",
+            lat[n / 2] / 1e3, lat[(n * 99) / 100] / 1e3, lat[n - 1] / 1e3, (n / 2.0) / s);
+    }
+    auModel = 0;
+}
+
+static uint32_t lowerBound(uint32_t t) {
+    //First record at or after t
+    uint32_t lo = 0, hi = records;
+    while(lo < hi) {
+        uint32_t mid = lo + ((hi - lo) >> 1);
+        if(recordTs(mid) < t) lo = mid + 1; else hi = mid;
+    }
+    return lo;
+}
+
+static void store(uint32_t base, uint32_t count, uint8_t prof, uint32_t rep) {
+    uint8_t rec[_SD_STORE_RECORD_SIZE];
+    uint32_t fails = 0, worstProbes = 0;
+    double total = 0, worst = 0, probes = 0, search = 0;
+    const char *name = (prof == P_STEP) ? ((rep == 1) ? "step" : "duplicates") : "skewed";
+
+    profile = prof;
+    repeat = rep;
+    records = count;
+    memset(cards[0].image + (base * 512), 0, 512);
+    SD_Store_Open(base);
+    uint64_t start = now;
+    if(base == (IMAGE_SECTORS - 1)) {
+        //Data blocks past the image: only the header is written, the card synthesizes the records
+        synthData = SD_STORE.data;
+        SD_STORE.count = count;
+        SD_Store_WriteHeader();
+        printf("store: %s, %lu records (%.2fGB) synthesized\n", name, (unsigned long)count, (double)count * _SD_STORE_RECORD_SIZE / 1e9);
+    } else {
+        synthData = 0;
+        if(!SD_Store_Begin()) {
+            printf("store: begin failed\n");
+            return;
+        }
+        for(uint32_t i=0; i<count; i++) {
+            makeRecord(rec, i);
+            SD_Store_Append(rec);
+        }
+        SD_Store_End();
+        printf("store: %s, %lu records written in %.2fs\n", name, (unsigned long)count, (double)(now - start) / 1e6);
+    }
+    if(SD_Store_Open(base) != _SD_OK_FLAG) {
+        printf("store: open failed\n");
+        return;
+    }
+
+    //Find the first record at or after random timestamps, reading from the block holding it. Then all records at t must follow
+    uint32_t first = recordTs(0);
+    uint32_t span = recordTs(count - 1) - first + 1;
+    for(uint16_t n=0; n<64; n++) {
+        uint32_t t = first + (uint32_t)((((uint64_t)rnd() << 24) | rnd()) % span);
+        uint32_t expected = lowerBound(t);
+        uint32_t same = lowerBound(t + 1) - expected;
+        uint32_t found = 0xFFFFFFFF, ts = 0, r;
+        start = now;
+        uint32_t before = cmdCount[18];
+        uint32_t at = SD_Store_Find(t);
+        uint32_t p = cmdCount[18] - before;
+        search += (double)(now - start) / 1e3;
+        if(SD_Store_ReadBegin(at)) {
+            while(SD_Store_Read(rec) == _SD_OK_FLAG) {
+                memcpy(&ts, rec, 4);
+                if(ts >= t) {
+                    memcpy(&found, rec + 4, 4);
+                    break;
+                }
+            }
+            double ms = (double)(now - start) / 1e3;
+            total += ms;
+            if(ms > worst) worst = ms;
+            probes += p;
+            if(p > worstProbes) worstProbes = p;
+            for(r=0; ts == t; r++) {
+                if(SD_Store_Read(rec) != _SD_OK_FLAG) break;
+                memcpy(&ts, rec, 4);
+            }
+            if(same != r) fails++;
+            SD_Store_ReadEnd();
+        }
+        if(found != expected) fails++;
+    }
+    printf("store: %s, query %.1fms average (%.1fms searching), %.1fms worst, %.1f probes average, %lu worst, %lu wrong\n",
+        name, total / 64, search / 64, worst, probes / 64, (unsigned long)worstProbes, (unsigned long)fails);
+
+    //Headers of another record size or layout are not opened
+    uint8_t *h = cards[0].image + (base * 512);
+    h[5]++;
+    uint8_t size = SD_Store_Open(base);
+    h[5]--;
+    h[6]--;
+    uint8_t version = SD_Store_Open(base);
+    h[6]++;
+    printf("store: header of another record size %s, of another layout %s\n",
+        (size == _SD_ERR_FLAG) ? "rejected" : "accepted", (version == _SD_ERR_FLAG) ? "rejected" : "accepted");
+}
+
+static int exportMode(void) {
+    //Card on RA5 with random data, served to tools/export on a pty until the host closes it
+    char path[256];
+    SD_SPI_Init();
+    SD_Export_Init();
+    SD_Card_Init();
+    if(!SD_Card_IsActive()) return 1;
+    for(uint32_t i=0; i<(IMAGE_SECTORS * 512); i++) cards[1].image[i] = (uint8_t)rnd();
+    snprintf(path, sizeof(path), "%s.ref", exportPrefix);
+    FILE *f = fopen(path, "wb");
+    if(!f || (fwrite(cards[1].image, 512, IMAGE_SECTORS, f) != IMAGE_SECTORS)) return 1;
+    fclose(f);
+
+    pty = posix_openpt(O_RDWR | O_NOCTTY);
+    if((pty < 0) || (grantpt(pty) != 0) || (unlockpt(pty) != 0)) return 1;
+    snprintf(path, sizeof(path), "%s.tty", exportPrefix);
+    unlink(path);
+    if(symlink(ptsname(pty), path) != 0) return 1;
+    fcntl(pty, F_SETFL, O_NONBLOCK);
+    printf("export: serving %s\n", path);
+    fflush(stdout);
+
+    SD_Export_Run();
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    for(int i=1; i<argc; i++) {
+        if(strcmp(argv[i], "-n") == 0) {
+            hasCmd23 = 0;
+        } else if((strcmp(argv[i], "-a") == 0) && ((i + 1) < argc)) {
+            accessUs = (uint32_t)atoi(argv[++i]);
+        } else if((strcmp(argv[i], "-b") == 0) && ((i + 1) < argc)) {
+            stopBusyUs = (uint32_t)atoi(argv[++i]);
+        } else if((strcmp(argv[i], "-w") == 0) && ((i + 1) < argc)) {
+            writeBusyUs = (uint32_t)atoi(argv[++i]);
+        } else if((strcmp(argv[i], "-u") == 0) && ((i + 1) < argc)) {
+            auCopyUs = (uint32_t)atoi(argv[++i]);
+        } else if((strcmp(argv[i], "-p") == 0) && ((i + 1) < argc)) {
+            packPrefix = argv[++i];
+        } else if((strcmp(argv[i], "-e") == 0) && ((i + 1) < argc)) {
+            exportPrefix = argv[++i];
+        } else {
+            fprintf(stderr, "Usage: %s [-n] [-a access time] [-b stop busy] [-w write busy] [-u AU copy time] [-p file prefix] [-e file prefix]\n", argv[0]);
+            return 1;
+        }
+    }
+    cards[0].image = calloc(IMAGE_SECTORS, 512);
+    cards[1].image = calloc(IMAGE_SECTORS, 512);
+    if((cards[0].image == NULL) || (cards[1].image == NULL)) return 1;
+    if(exportPrefix) return exportMode();
+
+    //The second card CS must be high before the first card is clocked
+    SD_SPI_Init();
+    SD_Card_Setup(&card1, _SD_SPI_CS_RA5);
+    uint64_t start = now;
+    SD_Card_Init();
+    printf("init: %s in %.1fms, CMD23 %s, AU %luKB, busy timeout %ums\n", SD_Card_IsActive() ? "active" : "failed",
+        (double)(now - start) / 1e3, SD_FLAGS.cardBlockCountOK ? "yes" : "no", (unsigned long)(SD_CURRENT->auBytes >> 10), SD_CURRENT->busyTimeout);
+    if(!SD_Card_IsActive()) return 1;
+
+    transfers();
+    writeBehind();
+    auWrites();
+    stripe();
+    pack();
+    scrub();
+    uint8_t block[512];
+    exportRange();
+    printf("read: sector 3000 %s\n", (SD_Card_ReadBlock(3000UL * 512, block) == _SD_ERR_FLAG) ? "rejected on data error token" : "accepted");
+    store(AU_SECTORS - 1, 20000, P_STEP, 1);
+    store((2 * AU_SECTORS) - 1, 20000, P_STEP, 200);
+    store(IMAGE_SECTORS - 1, (CARD_SECTORS - IMAGE_SECTORS) * _SD_STORE_RECORDS_PER_BLOCK, P_STEP, 1);
+    store(IMAGE_SECTORS - 1, (CARD_SECTORS - IMAGE_SECTORS) * _SD_STORE_RECORDS_PER_BLOCK, P_SKEW, 1);
+    free(cards[0].image);
+    free(cards[1].image);
+    return 0;
+}
\ No newline at end of file
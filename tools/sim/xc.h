@@ -0,0 +1,59 @@
+/*
+ * 20261019.001
+ * SD Card
+ *
+ * File: xc.h
+ * Host stand-in for the XC8 device header, used by sdsim.c
+ * Author: wizlab.it
+ *
+ * Only the registers used by SD.c, Scrub.c, Store.c, Pack.c and Export.c are provided.
+ * Reading SSP1STATbits clocks one byte through the simulated card, so every poll of
+ * BF is one SPI transfer. Timer0 and the delays follow the simulated time.
+ * EUSART: a byte written to TXREG is sent when PIR1bits or PORTAbits is read next,
+ * TXREG is 0x100 while empty. PORTAbits.RA3 carries the bytes of the host as a UART
+ * waveform, and each of them sets IOCAFbits.IOCAF3 if IOCANbits.IOCAN3 is set.
+ */
+
+#ifndef XC_H
+#define XC_H
+
+#include <stdint.h>
+
+typedef struct { unsigned RA0:1, RA1:1, RA2:1, RA3:1, RA4:1, RA5:1; } SIM_PORTA;
+typedef struct { unsigned TRISA0:1, TRISA1:1, TRISA2:1, TRISA3:1, TRISA4:1, TRISA5:1; } SIM_TRISA;
+typedef struct { unsigned SDOSEL:1, SSSEL:1, TXCKSEL:1, RXDTSEL:1; } SIM_APFCON;
+typedef struct { unsigned CKE:1, BF:1; } SIM_SSP1STAT;
+typedef struct { unsigned CKP:1, SSPM:4, SSPEN:1; } SIM_SSP1CON1;
+typedef struct { unsigned TXEN:1, SYNC:1, BRGH:1, TRMT:1; } SIM_TXSTA;
+typedef struct { unsigned SPEN:1, CREN:1; } SIM_RCSTA;
+typedef struct { unsigned BRG16:1; } SIM_BAUDCON;
+typedef struct { unsigned TXIF:1, RCIF:1; } SIM_PIR1;
+typedef struct { unsigned IOCAN0:1, IOCAN1:1, IOCAN2:1, IOCAN3:1, IOCAN4:1, IOCAN5:1; } SIM_IOCAN;
+typedef struct { unsigned IOCAF0:1, IOCAF1:1, IOCAF2:1, IOCAF3:1, IOCAF4:1, IOCAF5:1; } SIM_IOCAF;
+
+extern SIM_TRISA TRISAbits;
+extern SIM_APFCON APFCONbits;
+extern SIM_SSP1CON1 SSP1CON1bits;
+extern SIM_TXSTA TXSTAbits;
+extern SIM_RCSTA RCSTAbits;
+extern SIM_BAUDCON BAUDCONbits;
+extern SIM_IOCAN IOCANbits;
+extern volatile uint8_t SSP1BUF, LATA, TRISA, SPBRGL, SPBRGH;
+extern volatile uint16_t TXREG;
+
+SIM_SSP1STAT *sim_SSP1STAT(void);
+SIM_PORTA *sim_PORTA(void);
+SIM_PIR1 *sim_PIR1(void);
+SIM_IOCAF *sim_IOCAF(void);
+volatile uint8_t *sim_TMR0IF(void);
+void sim_Delay(uint32_t us);
+
+#define SSP1STATbits    (*sim_SSP1STAT())
+#define PORTAbits       (*sim_PORTA())
+#define PIR1bits        (*sim_PIR1())
+#define IOCAFbits       (*sim_IOCAF())
+#define TMR0IF          (*sim_TMR0IF())
+#define __delay_ms(x)   sim_Delay((uint32_t)(x) * 1000)
+#define __delay_us(x)   sim_Delay((uint32_t)(x))
+
+#endif
\ No newline at end of file
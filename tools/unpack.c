@@ -0,0 +1,85 @@
+/*
+ * 20261019.001
+ * SD Card
+ *
+ * File: unpack.c
+ * Host decoder for sectors written by Pack.c
+ * Author: wizlab.it
+ *
+ * Build: cc -o unpack tools/unpack.c
+ * Usage: unpack <image> <output> [first sector] [sector count]
+ * Read card image (e.g. dd if=/dev/mmcblk0 of=card.img) and write the raw
+ * data. Sectors without the pack magic are skipped, so a damaged sector only
+ * leaves a hole in the output.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#define BLOCK_SIZE      512
+#define PACK_MAGIC      0x50
+#define PACK_ESC        0xA5
+#define PACK_HEADER     5
+
+static long decode(const uint8_t *s, FILE *out) {
+    uint32_t offset = ((uint32_t)s[1] << 24) | ((uint32_t)s[2] << 16) | ((uint32_t)s[3] << 8) | s[4];
+    long written = 0;
+
+    if(fseek(out, (long)offset, SEEK_SET) != 0) return -1;
+    for(int i=PACK_HEADER; i<BLOCK_SIZE; i++) {
+        if(s[i] != PACK_ESC) {
+            fputc(s[i], out);
+            written++;
+            continue;
+        }
+
+        //Escape at the end of the sector, or with count 0, marks end of data
+        if((i + 1 >= BLOCK_SIZE) || (s[i + 1] == 0)) break;
+        if(i + 2 >= BLOCK_SIZE) return -1;
+        for(int j=0; j<s[i + 1]; j++) fputc(s[i + 2], out);
+        written += s[i + 1];
+        i += 2;
+    }
+    return written;
+}
+
+int main(int argc, char **argv) {
+    uint8_t sector[BLOCK_SIZE];
+    long first = 0, count = -1, total = 0, packed = 0;
+
+    if(argc < 3) {
+        fprintf(stderr, "Usage: %s <image> <output> [first sector] [sector count]\n", argv[0]);
+        return 1;
+    }
+    if(argc > 3) first = strtol(argv[3], NULL, 0);
+    if(argc > 4) count = strtol(argv[4], NULL, 0);
+
+    FILE *in = fopen(argv[1], "rb");
+    FILE *out = fopen(argv[2], "wb");
+    if(!in || !out) {
+        perror("fopen");
+        return 1;
+    }
+    if(fseek(in, first * BLOCK_SIZE, SEEK_SET) != 0) {
+        perror("fseek");
+        return 1;
+    }
+
+    for(long n=0; (count < 0) || (n < count); n++) {
+        if(fread(sector, 1, BLOCK_SIZE, in) != BLOCK_SIZE) break;
+        if(sector[0] != PACK_MAGIC) continue;
+        long written = decode(sector, out);
+        if(written < 0) {
+            fprintf(stderr, "Sector %ld: bad token, skipped\n", first + n);
+            continue;
+        }
+        total += written;
+        packed++;
+    }
+
+    fprintf(stderr, "%ld sectors, %ld bytes decoded (ratio %.2f)\n", packed, total, packed ? (double)total / (packed * BLOCK_SIZE) : 0.0);
+    fclose(in);
+    fclose(out);
+    return 0;
+}
\ No newline at end of file